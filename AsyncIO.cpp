@@ -0,0 +1,303 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#include "AsyncIO.hpp"
+#include "Statistics.hpp"
+
+using std::string;
+
+/** Largest piece of data written by a single request **/
+static const size_t CHUNK_SIZE=1024*1024;
+/** Limit of buffered data for copying from unmapped files **/
+static const size_t MAX_BYTES_IN_FLIGHT=64*1024*1024;
+
+static bool asyncIO=false;
+
+void setAsyncIO(bool enabled) {
+    asyncIO=enabled;
+}
+
+bool getAsyncIO() {
+    return asyncIO;
+}
+
+/******************************************************************************/
+
+OutputFile::OutputFile(const string &path) : path(path),
+        fd(::open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644)) {
+    if (fd<0)
+        throw path+": "+strerror(errno);
+}
+
+OutputFile::~OutputFile() {
+    ::close(fd);
+}
+
+/******************************************************************************/
+
+/** Submission and completion rings shared with the kernel **/
+struct WriteQueue::Ring {
+    int fd;
+    unsigned entries;
+    void * sqRing;
+    size_t sqRingSize;
+    void * cqRing;
+    size_t cqRingSize;
+    io_uring_sqe * sqes;
+    std::atomic<unsigned> * sqTail;
+    unsigned sqMask;
+    unsigned * sqArray;
+    std::atomic<unsigned> * cqHead;
+    std::atomic<unsigned> * cqTail;
+    unsigned cqMask;
+    io_uring_cqe * cqes;
+    unsigned toSubmit;
+    
+    static Ring * create(unsigned entries) {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int fd=syscall(__NR_io_uring_setup, entries, &params);
+        if (fd<0)
+            return nullptr; // not supported or disabled
+        
+        Ring * ring=new Ring;
+        ring->fd=fd;
+        ring->entries=params.sq_entries;
+        ring->sqRingSize=params.sq_off.array+params.sq_entries*sizeof(unsigned);
+        ring->cqRingSize=params.cq_off.cqes+params.cq_entries*sizeof(io_uring_cqe);
+        if (params.features&IORING_FEAT_SINGLE_MMAP)
+            ring->sqRingSize=ring->cqRingSize=std::max(ring->sqRingSize, ring->cqRingSize);
+        
+        ring->sqRing=mmap(nullptr, ring->sqRingSize, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        ring->cqRing=(params.features&IORING_FEAT_SINGLE_MMAP)?ring->sqRing:
+            mmap(nullptr, ring->cqRingSize, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        void * sqes=mmap(nullptr, params.sq_entries*sizeof(io_uring_sqe),
+            PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+        if ((ring->sqRing==MAP_FAILED)||(ring->cqRing==MAP_FAILED)||(sqes==MAP_FAILED)) {
+            if (sqes!=MAP_FAILED)
+                munmap(sqes, params.sq_entries*sizeof(io_uring_sqe));
+            ring->sqes=nullptr;
+            delete ring;
+            return nullptr;
+        }
+        
+        char * sq=static_cast<char *>(ring->sqRing);
+        char * cq=static_cast<char *>(ring->cqRing);
+        ring->sqes=static_cast<io_uring_sqe *>(sqes);
+        ring->sqTail=reinterpret_cast<std::atomic<unsigned> *>(sq+params.sq_off.tail);
+        ring->sqMask=*reinterpret_cast<unsigned *>(sq+params.sq_off.ring_mask);
+        ring->sqArray=reinterpret_cast<unsigned *>(sq+params.sq_off.array);
+        ring->cqHead=reinterpret_cast<std::atomic<unsigned> *>(cq+params.cq_off.head);
+        ring->cqTail=reinterpret_cast<std::atomic<unsigned> *>(cq+params.cq_off.tail);
+        ring->cqMask=*reinterpret_cast<unsigned *>(cq+params.cq_off.ring_mask);
+        ring->cqes=reinterpret_cast<io_uring_cqe *>(cq+params.cq_off.cqes);
+        ring->toSubmit=0;
+        return ring;
+    }
+    
+    ~Ring() {
+        if (sqes)
+            munmap(sqes, entries*sizeof(io_uring_sqe));
+        if ((cqRing!=sqRing)&&(cqRing!=MAP_FAILED))
+            munmap(cqRing, cqRingSize);
+        if (sqRing!=MAP_FAILED)
+            munmap(sqRing, sqRingSize);
+        ::close(fd);
+    }
+    
+    io_uring_sqe * next() {
+        unsigned tail=sqTail->load(std::memory_order_relaxed);
+        unsigned index=tail&sqMask;
+        io_uring_sqe * sqe=&sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqArray[index]=index;
+        sqTail->store(tail+1, std::memory_order_release);
+        toSubmit++;
+        return sqe;
+    }
+    
+    void enter(unsigned minComplete) {
+        unsigned flags=minComplete?IORING_ENTER_GETEVENTS:0;
+        while (toSubmit||minComplete) {
+            int retval=syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+            if (retval<0) {
+                if ((errno==EINTR)||(errno==EAGAIN)||(errno==EBUSY))
+                    continue;
+                throw string("io_uring_enter(): ")+strerror(errno);
+            }
+            toSubmit-=std::min<unsigned>(retval, toSubmit);
+            if (!toSubmit)
+                break;
+        }
+    }
+};
+
+/** A read or a write in flight **/
+struct WriteQueue::Request {
+    enum Kind { READ, WRITE } kind;
+    File file;
+    /** Keeps the data alive **/
+    Span data;
+    int in;
+    off_t offset;
+    
+    Request(Kind kind, const File &file, const Span &data, int in, off_t offset) :
+        kind(kind), file(file), data(data), in(in), offset(offset) {}
+};
+
+/******************************************************************************/
+
+WriteQueue::WriteQueue(unsigned depth) :
+        ring(getAsyncIO()?Ring::create(depth):nullptr), inFlight(0), bytesInFlight(0),
+        chained(false) {}
+
+WriteQueue::~WriteQueue() {
+    try {
+        wait();
+    }
+    catch (...) {}
+    delete ring;
+}
+
+WriteQueue::File WriteQueue::open(const string &path) {
+    return std::make_shared<OutputFile>(path);
+}
+
+void WriteQueue::write(const File &file, const Span &data, off_t offset) {
+    for (size_t done=0; done<data.size(); done+=CHUNK_SIZE) {
+        size_t length=std::min(CHUNK_SIZE, data.size()-done);
+        Span piece(data, done, length);
+        
+        if (!ring) {
+            for (size_t written=0; written<length;) {
+                ssize_t retval=pwrite(file->get(), piece.data()+written, length-written, offset+done+written);
+                if (retval<0)
+                    throw file->getPath()+": "+strerror(errno);
+                written+=retval;
+            }
+        }
+        else
+            submit(new Request(Request::WRITE, file, piece, -1, offset+done));
+    }
+}
+
+void WriteQueue::copy(const File &file, int in, off_t inOffset, size_t length, off_t offset) {
+    for (size_t done=0; done<length; done+=CHUNK_SIZE) {
+        size_t chunk=std::min(CHUNK_SIZE, length-done);
+        Span buffer{ByteArray(chunk)};
+        count(Statistics::PREADS);
+        count(Statistics::BYTES_READ, chunk);
+        
+        if (!ring) {
+            ssize_t retval=pread(in, const_cast<uint8_t *>(buffer.data()), chunk, inOffset+done);
+            if (retval<0)
+                throw string("pread(): ")+strerror(errno);
+            if (size_t(retval)<chunk)
+                throw EOFException();
+            write(file, buffer, offset+done);
+        }
+        else {
+            // The write starts only after the read has completed successfully
+            submit(new Request(Request::READ, file, buffer, in, inOffset+done), true);
+            submit(new Request(Request::WRITE, file, buffer, -1, offset+done));
+        }
+    }
+}
+
+void WriteQueue::wait() {
+    if (ring)
+        while (inFlight)
+            reap(1);
+    check();
+}
+
+void WriteQueue::submit(Request * request, bool linked) {
+    // Keep one slot for the second part of a linked pair, which must be
+    // queued right after the first one
+    while (!chained&&((inFlight+2>ring->entries)||(bytesInFlight>MAX_BYTES_IN_FLIGHT)))
+        reap(1);
+    chained=linked;
+    
+    io_uring_sqe * sqe=ring->next();
+    sqe->opcode=request->kind==Request::READ?IORING_OP_READ:IORING_OP_WRITE;
+    sqe->fd=request->kind==Request::READ?request->in:request->file->get();
+    sqe->addr=reinterpret_cast<uint64_t>(request->data.data());
+    sqe->len=request->data.size();
+    sqe->off=request->offset;
+    sqe->user_data=reinterpret_cast<uint64_t>(request);
+    if (linked)
+        sqe->flags|=IOSQE_IO_LINK;
+    
+    inFlight++;
+    bytesInFlight+=request->data.size();
+    if (!linked)
+        ring->enter(0);
+}
+
+void WriteQueue::reap(unsigned minimum) {
+    ring->enter(minimum);
+    
+    // Release the completion ring before handling
+    std::vector<std::pair<Request *, int>> completions;
+    unsigned head=ring->cqHead->load(std::memory_order_relaxed);
+    unsigned tail=ring->cqTail->load(std::memory_order_acquire);
+    for (; head!=tail; head++) {
+        const io_uring_cqe &cqe=ring->cqes[head&ring->cqMask];
+        completions.emplace_back(reinterpret_cast<Request *>(cqe.user_data), cqe.res);
+    }
+    ring->cqHead->store(head, std::memory_order_release);
+    
+    // The rest of short writes is submitted after all completions are
+    // handled, because submitting may reap again
+    std::vector<std::unique_ptr<Request>> rest;
+    for (auto i=completions.begin(); i!=completions.end(); ++i)
+        if (Request * request=complete(i->first, i->second))
+            rest.emplace_back(request);
+    for (auto i=rest.begin(); i!=rest.end(); ++i)
+        submit(i->release());
+}
+
+WriteQueue::Request * WriteQueue::complete(Request * request, int result) {
+    std::unique_ptr<Request> guard(request);
+    inFlight--;
+    bytesInFlight-=request->data.size();
+    
+    if (result<0) {
+        // A write cancelled after a failed read is not a separate error
+        if (error.empty()&&(result!=-ECANCELED))
+            error=request->file->getPath()+": "+strerror(-result);
+    }
+    else if (size_t(result)<request->data.size()) {
+        if (request->kind==Request::READ) {
+            if (error.empty())
+                error=request->file->getPath()+": premature end of file or block";
+        }
+        else {
+            // Short write, the rest is queued again
+            Span rest(request->data, result, request->data.size()-result);
+            return new Request(Request::WRITE, request->file, rest, -1, request->offset+result);
+        }
+    }
+    return nullptr;
+}
+
+void WriteQueue::check() {
+    if (!error.empty()) {
+        string message;
+        message.swap(error);
+        throw message;
+    }
+}
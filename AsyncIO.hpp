@@ -0,0 +1,78 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#ifndef __ASYNCIO_HPP
+#define __ASYNCIO_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "REUtils.hpp"
+
+/** Enable asynchronous writing of extracted files with io_uring **/
+void setAsyncIO(bool enabled);
+/** Whether asynchronous writing is requested **/
+bool getAsyncIO();
+
+/** Output file with writes in flight; the descriptor is closed when the last
+    write completes and the last handle is dropped **/
+class OutputFile {
+public:
+    explicit OutputFile(const std::string &path);
+    ~OutputFile();
+    int get() const { return fd; }
+    const std::string &getPath() const { return path; }
+    
+private:
+    OutputFile(const OutputFile &other)=delete;
+    OutputFile &operator =(const OutputFile &other)=delete;
+    
+    std::string path;
+    int fd;
+};
+
+/** Keeps many extraction reads and writes in flight with io_uring, or
+    performs them synchronously if io_uring is not available **/
+class WriteQueue {
+public:
+    using File=std::shared_ptr<OutputFile>;
+    
+    /** `depth` is the maximum number of requests in flight **/
+    explicit WriteQueue(unsigned depth=64);
+    /** Waits for all requests **/
+    ~WriteQueue();
+    /** Whether requests are really asynchronous **/
+    bool isAsync() const { return ring!=nullptr; }
+    /** Create an output file (truncating it) **/
+    File open(const std::string &path);
+    /** Write `data` at `offset`; the span keeps the data (its copy or the mapped
+        input) alive until the write completes **/
+    void write(const File &file, const Span &data, off_t offset);
+    /** Copy `length` bytes from descriptor `in` at `inOffset` to `offset` of the file **/
+    void copy(const File &file, int in, off_t inOffset, size_t length, off_t offset);
+    /** Wait for all requests in flight, throws if any of them failed **/
+    void wait();
+    
+private:
+    struct Ring;
+    struct Request;
+    
+    WriteQueue(const WriteQueue &other)=delete;
+    WriteQueue &operator =(const WriteQueue &other)=delete;
+    
+    void submit(Request * request, bool linked=false);
+    void reap(unsigned minimum);
+    /** Handle a completion, return the rest of a short write to be submitted **/
+    Request * complete(Request * request, int result);
+    void check();
+    
+    Ring * ring;
+    unsigned inFlight;
+    size_t bytesInFlight;
+    /** Whether the last request was linked to the next one **/
+    bool chained;
+    std::string error;
+};
+
+#endif
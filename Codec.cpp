@@ -0,0 +1,80 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#include <set>
+#include "Codec.hpp"
+#include "Statistics.hpp"
+
+using std::set;
+using std::string;
+using std::vector;
+
+/******************************************************************************/
+
+static set<const CodecRegistration *> &getCodecs() {
+    static set<const CodecRegistration *> list;
+    return list;
+}
+
+CodecRegistration::CodecRegistration(const char * name, SniffFunction sniff, CreateFunction create) :
+        name(name), sniffFunction(sniff), createFunction(create) {
+    getCodecs().insert(this);
+}
+
+CodecRegistration::~CodecRegistration() {
+    getCodecs().erase(this);
+}
+
+vector<const char *> CodecRegistration::list() {
+    vector<const char *> result;
+    auto &codecs=getCodecs();
+    
+    for (auto i=codecs.begin(); i!=codecs.end(); ++i)
+        result.emplace_back((*i)->name);
+    
+    return result;
+}
+
+const CodecRegistration * CodecRegistration::get(const string &name) {
+    auto &codecs=getCodecs();
+    
+    for (auto i=codecs.begin(); i!=codecs.end(); ++i)
+        if (name==(*i)->name)
+            return *i;
+    
+    return nullptr;
+}
+
+const CodecRegistration * CodecRegistration::sniff(const uint8_t * data, size_t length) {
+    auto &codecs=getCodecs();
+    
+    for (auto i=codecs.begin(); i!=codecs.end(); ++i)
+        if ((*i)->sniffFunction(data, length))
+            return *i;
+    
+    return nullptr;
+}
+
+/******************************************************************************/
+
+void decode(const string &codec, const void * data, size_t length, Sink &output) {
+    const CodecRegistration * registration=codec.empty()?
+        CodecRegistration::sniff(static_cast<const uint8_t *>(data), length):
+        CodecRegistration::get(codec);
+    if (!registration)
+        throw codec.empty()?string("cannot detect compression"):"unknown codec `"+codec+"`";
+    
+    PhaseTimer timer(Statistics::DECODE);
+    auto decoder=registration->create(output);
+    decoder->update(data, length);
+    decoder->finish();
+}
+
+ByteArray decode(const string &codec, const Span &in) {
+    ByteArray result;
+    result.reserve(in.size()*2);
+    BufferSink sink(result);
+    decode(codec, in.data(), in.size(), sink);
+    return result;
+}
@@ -0,0 +1,55 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#ifndef __CODEC_HPP
+#define __CODEC_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "REUtils.hpp"
+
+/** Registration of a decompression algorithm **/
+class CodecRegistration {
+public:
+    using SniffFunction=bool(*)(const uint8_t * data, size_t length);
+    using CreateFunction=std::unique_ptr<Decoder>(*)(Sink &output);
+    /** Add a codec **/
+    CodecRegistration(const char * name, SniffFunction sniff, CreateFunction create);
+    /** Unregister this codec **/
+    ~CodecRegistration();
+    /** List the codecs **/
+    static std::vector<const char *> list();
+    /** Get the codec by its name **/
+    static const CodecRegistration * get(const std::string &name);
+    /** Detect the codec by the magic number at the beginning of the data **/
+    static const CodecRegistration * sniff(const uint8_t * data, size_t length);
+    /** Always returns false, for codecs without a magic number **/
+    static bool no(const uint8_t * data, size_t length) { return false; }
+    /** Name of the codec **/
+    const char * getName() const { return name; }
+    /** Create a decoder writing to `output` **/
+    std::unique_ptr<Decoder> create(Sink &output) const { return createFunction(output); }
+    
+private:
+    explicit CodecRegistration(const CodecRegistration &other)=delete;
+    CodecRegistration &operator =(const CodecRegistration &other)=delete;
+    
+    const char * name;
+    SniffFunction sniffFunction;
+    CreateFunction createFunction;
+};
+
+/** Decode a whole blob with the named codec, or with a detected one if the
+    name is empty **/
+void decode(const std::string &codec, const void * data, size_t length, Sink &output);
+/** Decode a whole blob into memory **/
+ByteArray decode(const std::string &codec, const Span &in);
+
+#define CODEC(name) \
+    static const CodecRegistration _##name##_codec(#name, sniff, create)
+#define CODEC_NOSNIFF(name) \
+    static const CodecRegistration _##name##_codec(#name, &CodecRegistration::no, create)
+
+#endif
@@ -0,0 +1,307 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
+#include <fnmatch.h>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sys/stat.h>
+#include "AsyncIO.hpp"
+#include "Context.hpp"
+#include "Incremental.hpp"
+#include "Progress.hpp"
+#include "REUtils.hpp"
+#include "Statistics.hpp"
+#include "Trace.hpp"
+#include "TypeRegistration.hpp"
+
+using std::string;
+
+/******************************************************************************/
+
+/** Paths are matched without the leading slash some formats use **/
+static const char * relative(const string &path) {
+    size_t start=path.find_first_not_of('/');
+    return path.c_str()+(start==string::npos?path.size():start);
+}
+
+void Filter::include(const string &pattern) {
+    includes.push_back(relative(pattern));
+}
+
+void Filter::exclude(const string &pattern) {
+    excludes.push_back(relative(pattern));
+}
+
+void Filter::includeIds(const string &ranges) {
+    for (const char * p=ranges.c_str(); *p;) {
+        char * end;
+        uint64_t first=strtoull(p, &end, 0), last=first;
+        if (end==p)
+            throw "bad id range";
+        if (*end=='-')
+            last=strtoull(end+1, &end, 0);
+        ids.emplace_back(first, last);
+        p=*end==','?end+1:end;
+    }
+}
+
+bool Filter::matches(const string &path) const {
+    const char * name=relative(path);
+    for (auto i=excludes.begin(); i!=excludes.end(); ++i)
+        if (fnmatch(i->c_str(), name, 0)==0)
+            return false;
+    if (includes.empty())
+        return true;
+    for (auto i=includes.begin(); i!=includes.end(); ++i)
+        if (fnmatch(i->c_str(), name, 0)==0)
+            return true;
+    return false;
+}
+
+bool Filter::mayContain(const string &path) const {
+    string directory=relative(path);
+    
+    // `*` matches everything after a matching prefix, so the whole subtree is excluded
+    for (auto i=excludes.begin(); i!=excludes.end(); ++i)
+        if (!i->empty()&&(i->back()=='*')&&(fnmatch(i->c_str(), directory.c_str(), 0)==0))
+            return false;
+    if (includes.empty())
+        return true;
+    
+    // A pattern may match under the directory if its literal beginning and
+    // the directory agree as far as both go
+    for (auto i=includes.begin(); i!=includes.end(); ++i) {
+        size_t literal=std::min(i->find_first_of("*?[\\"), i->size());
+        size_t common=std::min(literal, directory.size());
+        if (i->compare(0, common, directory, 0, common)==0)
+            return true;
+    }
+    return false;
+}
+
+bool Filter::matchesId(uint64_t id) const {
+    if (ids.empty())
+        return true;
+    for (auto i=ids.begin(); i!=ids.end(); ++i)
+        if ((id>=i->first)&&(id<=i->second))
+            return true;
+    return false;
+}
+
+/******************************************************************************/
+
+/** Sink which owns the file it writes to **/
+class NewFileSink : public Sink {
+public:
+    explicit NewFileSink(const string &path) : file(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC), sink(file) {}
+    void write(const void * data, size_t length) override { sink.write(data, length); }
+    
+private:
+    upp::File file;
+    FileSink sink;
+};
+
+/** Records the file in the incremental state once it is complete **/
+class RecordingSink : public Sink {
+public:
+    RecordingSink(std::unique_ptr<Sink> sink, Incremental &incremental, const string &path,
+            const BinaryReader &source, const string &hash) :
+        sink(std::move(sink)), incremental(incremental), path(path), source(source), hash(hash) {}
+    ~RecordingSink() {
+        // The file must be closed before its modification time is taken
+        sink.reset();
+        if (!std::uncaught_exceptions())
+            incremental.record(path, source, hash);
+    }
+    void write(const void * data, size_t length) override { sink->write(data, length); }
+    
+private:
+    std::unique_ptr<Sink> sink;
+    Incremental &incremental;
+    string path;
+    BinaryReader source;
+    string hash;
+};
+
+/** Events of the files which are reported before they are saved, emitted
+    with the hash of the saved contents once they are complete **/
+class PendingEntries {
+public:
+    explicit PendingEntries(EventSink &events) : events(events) {}
+    /** The files which were not saved, e.g. unpacked in memory, have no hash **/
+    ~PendingEntries() {
+        for (auto i=entries.begin(); i!=entries.end(); ++i)
+            events.emit(i->second);
+    }
+    void add(const Event &event) {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.emplace(event.path, event);
+    }
+    bool contains(const string &path) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.count(path);
+    }
+    /** Emit the events of the file at `path` with its hash **/
+    void complete(const string &path, const string &hash) {
+        std::vector<Event> done;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto range=entries.equal_range(path);
+            for (auto i=range.first; i!=range.second; ++i) {
+                done.push_back(i->second);
+                done.back().sha256=hash;
+            }
+            entries.erase(range.first, range.second);
+        }
+        for (auto i=done.begin(); i!=done.end(); ++i)
+            events.emit(*i);
+    }
+    
+private:
+    EventSink &events;
+    std::mutex mutex;
+    std::multimap<string, Event> entries;
+};
+
+/** Computes the SHA-256 of a file while it is written, for its pending event **/
+class HashingSink : public Sink {
+public:
+    HashingSink(std::unique_ptr<Sink> sink, PendingEntries &pending, const string &path) :
+        sink(std::move(sink)), pending(pending), path(path) {}
+    ~HashingSink() {
+        // An incomplete file keeps its event without a hash
+        sink.reset();
+        if (!std::uncaught_exceptions())
+            pending.complete(path, hasher.finish());
+    }
+    void write(const void * data, size_t length) override {
+        hasher.update(data, length);
+        sink->write(data, length);
+    }
+    
+private:
+    std::unique_ptr<Sink> sink;
+    PendingEntries &pending;
+    string path;
+    Hasher hasher;
+};
+
+Context::Context(const string &outputDir, EventSink * events, bool listing, std::shared_ptr<const Filter> filter,
+        Output * output, Incremental * incremental) :
+    outputDir(outputDir), events(events), listing(listing), filter(std::move(filter)), output(output),
+    incremental(incremental),
+    pending(events&&!listing&&events->wantsHashes()?std::make_shared<PendingEntries>(*events):nullptr) {}
+
+void Context::createDirectory() const {
+    if (writesFiles())
+        mkdir(outputDir.c_str(), 0700);
+}
+
+std::unique_ptr<Sink> Context::create(const string &name) const {
+    count(Statistics::FILES);
+    progressEntry(getPath(name));
+    return meter(open(getPath(name)));
+}
+
+std::unique_ptr<Sink> Context::create(const string &name, const BinaryReader &source) const {
+    // The handler has got as far as the end of the source of the file
+    progressReached(source.getSource(), source.debug()+source.available());
+    if (!incremental)
+        return create(name);
+    string path=getPath(name), hash;
+    if (incremental->isUnchanged(path, source, hash))
+        return nullptr;
+    auto sink=create(name);
+    if (!sink)
+        return nullptr;
+    return std::unique_ptr<Sink>(new RecordingSink(std::move(sink), *incremental, path, source, hash));
+}
+
+std::unique_ptr<BlockSink> Context::createBlocks(const string &name) const {
+    if (!output)
+        return nullptr;
+    count(Statistics::FILES);
+    progressEntry(getPath(name));
+    return output->createBlocks(getPath(name));
+}
+
+void Context::write(const BinaryReader &payload, const string &name, WriteQueue * queue) const {
+    BinaryReader copy(payload, payload.tell(), payload.available());
+    string hash;
+    if (incremental&&incremental->isUnchanged(getPath(name), copy, hash))
+        return;
+    // The source of a new output is hashed while it is copied
+    std::optional<Hasher> hasher;
+    if (incremental&&hash.empty())
+        hasher.emplace();
+    Hasher * hashing=hasher?&*hasher:nullptr;
+    PhaseTimer timer(Statistics::WRITE);
+    TraceSpan span("write", name, copy.debug(), copy.available());
+    count(Statistics::FILES);
+    progressEntry(getPath(name));
+    if (output||(pending&&pending->contains(getPath(name)))) {
+        // Through a sink, which also hashes the file if its event waits for that
+        auto sink=open(getPath(name));
+        if (sink)
+            copy.extract(*sink, hashing);
+    }
+    else if (queue&&!hashing)
+        copy.extract(getPath(name), *queue);
+    else
+        copy.extract(getPath(name), true, hashing);
+    if (incremental)
+        incremental->record(getPath(name), payload, hasher?hasher->finish():hash);
+}
+
+std::unique_ptr<Sink> Context::open(const string &path) const {
+    std::unique_ptr<Sink> sink=output?output->create(path):std::unique_ptr<Sink>(new NewFileSink(path));
+    if (sink&&pending&&pending->contains(path))
+        return std::unique_ptr<Sink>(new HashingSink(std::move(sink), *pending, path));
+    return sink;
+}
+
+void Context::addContainer(const char * format, uint64_t offset, uint64_t size) const {
+    if (events)
+        events->emit(Event {Event::CONTAINER, format, outputDir, offset, size, nullptr, string()});
+}
+
+void Context::addBlock(const string &type, uint64_t offset, uint64_t size) const {
+    if (events)
+        events->emit(Event {Event::BLOCK, type, outputDir, offset, size, nullptr, string()});
+}
+
+void Context::addDirectory(const string &name, uint64_t offset, uint64_t size) const {
+    if (events&&wantsDirectory(name))
+        events->emit(Event {Event::DIRECTORY, name, getPath(name), offset, size, nullptr, string()});
+}
+
+void Context::addEntry(const string &name, uint64_t offset, uint64_t size, const char * compression) const {
+    if (events&&wants(name))
+        events->emit(Event {Event::FILE, name, getPath(name), offset, size, compression, string()});
+}
+
+void Context::addEntry(const string &name, const BinaryReader &payload, const char * compression) const {
+    if (events&&wants(name)) {
+        Event event {Event::FILE, name, getPath(name), uint64_t(payload.debug()), payload.available(),
+            compression, string()};
+        if (pending)
+            pending->add(event);
+        else
+            events->emit(event);
+    }
+}
+
+void Context::save(const BinaryReader &payload, const string &name) const {
+    // Unpacked recursively, it is reported as a container instead of a file
+    if (TypeRegistration::offer(payload, *this, name))
+        return;
+    addEntry(name, payload);
+    if (!listing&&wants(name))
+        write(payload, name);
+}
@@ -0,0 +1,141 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#ifndef __CONTEXT_HPP
+#define __CONTEXT_HPP
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Events.hpp"
+
+class BinaryReader;
+class BlockSink;
+class Incremental;
+class PendingEntries;
+class Sink;
+class WriteQueue;
+
+/** Selects the entries to unpack by their paths (relative to the output
+    directory) and ids (resource ids, section or block types) **/
+class Filter {
+public:
+    /** Unpack only the paths matching one of these patterns (fnmatch(), `*` also matches `/`) **/
+    void include(const std::string &pattern);
+    /** Never unpack the paths matching this pattern **/
+    void exclude(const std::string &pattern);
+    /** Unpack only the ids in these ranges, e.g. `1-5,0x17` **/
+    void includeIds(const std::string &ranges);
+    /** Whether the file `path` is selected **/
+    bool matches(const std::string &path) const;
+    /** Whether anything under the directory `path` may be selected **/
+    bool mayContain(const std::string &path) const;
+    /** Whether the entry with this id is selected **/
+    bool matchesId(uint64_t id) const;
+    /** Whether the entries are selected by their ids too **/
+    bool hasIds() const { return !ids.empty(); }
+    
+private:
+    std::vector<std::string> includes;
+    std::vector<std::string> excludes;
+    std::vector<std::pair<uint64_t, uint64_t>> ids;
+};
+
+/** Receiver of the unpacked files instead of the file system **/
+class Output {
+public:
+    virtual ~Output() {}
+    /** Start the file at `path`; its contents are written to the returned
+        sink, which is destroyed at the end of the file. nullptr skips the file **/
+    virtual std::unique_ptr<Sink> create(const std::string &path)=0;
+    /** Start the file at `path` written in pieces at any offsets; nullptr if
+        the output only takes files in order, which are then assembled first **/
+    virtual std::unique_ptr<BlockSink> createBlocks(const std::string &path) { return nullptr; }
+};
+
+/** Where the contents of a file go: files in an output directory (or an
+    Output) and events describing them, or only the events in listing mode **/
+class Context {
+public:
+    /** Unpack to `outputDir` reporting to `events` (if not null); if `listing`
+        is set, only report the entries. Files go to `output` instead of the
+        file system if it is not null, and those unchanged since the run
+        recorded in `incremental` (if not null) are skipped **/
+    explicit Context(const std::string &outputDir, EventSink * events=nullptr, bool listing=false,
+            std::shared_ptr<const Filter> filter=nullptr, Output * output=nullptr,
+            Incremental * incremental=nullptr);
+    /** Context for the subdirectory `name` **/
+    Context(const Context &parent, const std::string &name) :
+        outputDir(parent.outputDir+'/'+name), prefix(parent.prefix+name+'/'),
+        events(parent.events), listing(parent.listing), filter(parent.filter), output(parent.output),
+        incremental(parent.incremental), pending(parent.pending) {}
+    /** Output directory **/
+    const std::string &getOutputDir() const { return outputDir; }
+    /** Path of `name` in the output directory **/
+    std::string getPath(const std::string &name) const { return outputDir+'/'+name; }
+    /** Whether entries are only listed, without reading or writing their contents **/
+    bool isListing() const { return listing; }
+    /** Whether the file `name` is selected by the filter **/
+    bool wants(const std::string &name) const { return !filter||filter->matches(prefix+name); }
+    /** Whether anything in the subdirectory `name` may be selected by the filter **/
+    bool wantsDirectory(const std::string &name) const { return !filter||filter->mayContain(prefix+name+'/'); }
+    /** Whether the entry with this id (resource id, section or block type) is selected **/
+    bool wantsId(uint64_t id) const { return !filter||filter->matchesId(id); }
+    /** Whether some ids are not selected, which only the handlers can tell **/
+    bool selectsIds() const { return filter&&filter->hasIds(); }
+    /** Receiver of the files, nullptr if they are written to the file system **/
+    Output * getOutput() const { return output; }
+    /** Whether the files go to the output directory: neither listing nor an Output **/
+    bool writesFiles() const { return !listing&&!output; }
+    /** Create the output directory, unless listing or writing to an Output **/
+    void createDirectory() const;
+    /** Start the file `name`, returns nullptr if an Output skips it **/
+    std::unique_ptr<Sink> create(const std::string &name) const;
+    /** Start the file `name` decoded from the rest of `source`; also returns
+        nullptr if the file is unchanged since the previous run **/
+    std::unique_ptr<Sink> create(const std::string &name, const BinaryReader &source) const;
+    /** Start the file `name` of the Output written in pieces at any offsets,
+        nullptr if the Output only takes files in order **/
+    std::unique_ptr<BlockSink> createBlocks(const std::string &name) const;
+    /** Write the rest of `payload` as the file `name`, through `queue` if given **/
+    void write(const BinaryReader &payload, const std::string &name, WriteQueue * queue=nullptr) const;
+    /** Report that the input is a container of `format` unpacked to the output directory **/
+    void addContainer(const char * format, uint64_t offset, uint64_t size) const;
+    /** Report a block of `type` in the container **/
+    void addBlock(const std::string &type, uint64_t offset, uint64_t size) const;
+    /** Report the subdirectory `name` described by the table at `offset` **/
+    void addDirectory(const std::string &name, uint64_t offset, uint64_t size) const;
+    /** Report a file of `size` bytes at `offset` of the input, stored with
+        `compression` (nullptr if stored as is) **/
+    void addEntry(const std::string &name, uint64_t offset, uint64_t size,
+        const char * compression=nullptr) const;
+    /** Report the rest of `payload` as a file. If the events want hashes and
+        the file is saved, the event is emitted then, with the SHA-256 of the
+        saved contents **/
+    void addEntry(const std::string &name, const BinaryReader &payload,
+        const char * compression=nullptr) const;
+    /** Save the rest of `payload` as `name`: list it, unpack it in memory
+        with --recursive, or write it to a file **/
+    void save(const BinaryReader &payload, const std::string &name) const;
+    
+private:
+    /** Sink of the file at `path`, hashing it if its event waits for that **/
+    std::unique_ptr<Sink> open(const std::string &path) const;
+    
+    std::string outputDir;
+    /** Path of the output directory relative to the top one, as seen by the filter **/
+    std::string prefix;
+    EventSink * events;
+    bool listing;
+    std::shared_ptr<const Filter> filter;
+    Output * output;
+    Incremental * incremental;
+    /** Events of the files waiting for their hashes, shared by the subdirectories **/
+    std::shared_ptr<PendingEntries> pending;
+};
+
+#endif
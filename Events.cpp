@@ -0,0 +1,115 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#include <cstdio>
+#include <openssl/evp.h>
+#include "Events.hpp"
+#include "REUtils.hpp"
+
+using std::string;
+
+/******************************************************************************/
+
+static const char * const TYPE_NAMES[]={"container", "block", "directory", "file"};
+
+void appendJSONString(string &out, const string &value) {
+    out+='"';
+    for (auto i=value.begin(); i!=value.end(); ++i) {
+        unsigned char c=*i;
+        if ((c=='"')||(c=='\\')) {
+            out+='\\';
+            out+=c;
+        }
+        else if (c<0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out+=escaped;
+        }
+        else
+            out+=c;
+    }
+    out+='"';
+}
+
+/******************************************************************************/
+
+void TextEventSink::emit(const Event &event) {
+    if (event.type==Event::FILE)
+        output << Hex<uint64_t>(event.offset) << '\t' << event.size << '\t' <<
+            (event.compression?event.compression:"-") << '\t' << event.path << '\n';
+}
+
+JsonEventSink::~JsonEventSink() {
+    output << buffer << std::flush;
+}
+
+void JsonEventSink::emit(const Event &event) {
+    string line="{\"type\":\"";
+    line+=TYPE_NAMES[event.type];
+    line+="\",\"name\":";
+    appendJSONString(line, event.name);
+    line+=",\"path\":";
+    appendJSONString(line, event.path);
+    line+=",\"offset\":"+std::to_string(event.offset);
+    line+=",\"size\":"+std::to_string(event.size);
+    if (event.compression) {
+        line+=",\"compression\":\"";
+        line+=event.compression;
+        line+='"';
+    }
+    if (!event.sha256.empty())
+        line+=",\"sha256\":\""+event.sha256+'"';
+    line+="}\n";
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    buffer+=line;
+    if (buffer.size()>=BUFFER_SIZE) {
+        output << buffer;
+        buffer.clear();
+    }
+}
+
+string toHex(const void * data, size_t length) {
+    static const char HEXCHARS[]="0123456789abcdef";
+    const unsigned char * bytes=static_cast<const unsigned char *>(data);
+    string result;
+    result.reserve(2*length);
+    for (size_t i=0; i<length; i++) {
+        result+=HEXCHARS[bytes[i]>>4];
+        result+=HEXCHARS[bytes[i]&15];
+    }
+    return result;
+}
+
+string sha256(const Span &data) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned length=0;
+    if (EVP_Digest(data.data(), data.size(), digest, &length, EVP_sha256(), nullptr)!=1)
+        throw "EVP_Digest()";
+    return toHex(digest, length);
+}
+
+/******************************************************************************/
+
+Hasher::Hasher() : context(EVP_MD_CTX_new()) {
+    if (!context||(EVP_DigestInit_ex(context, EVP_sha256(), nullptr)!=1)) {
+        EVP_MD_CTX_free(context);
+        throw "EVP_DigestInit_ex()";
+    }
+}
+
+Hasher::~Hasher() {
+    EVP_MD_CTX_free(context);
+}
+
+void Hasher::update(const void * data, size_t length) {
+    EVP_DigestUpdate(context, data, length);
+}
+
+string Hasher::finish() {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned length=0;
+    EVP_DigestFinal_ex(context, digest, &length);
+    return toHex(digest, length);
+}
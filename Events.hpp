@@ -0,0 +1,95 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#ifndef __EVENTS_HPP
+#define __EVENTS_HPP
+
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+class Span;
+struct evp_md_ctx_st;
+
+/** Something found in the input: a container, a block of a container,
+    a directory or a file **/
+struct Event {
+    enum Type { CONTAINER, BLOCK, DIRECTORY, FILE };
+    
+    Type type;
+    /** Format of a container, type of a block, or the name of a directory or a file **/
+    std::string name;
+    /** Path in the output **/
+    std::string path;
+    /** Position of the data in the input which contains it **/
+    uint64_t offset;
+    uint64_t size;
+    /** Codec of the stored data, nullptr if it is stored as is **/
+    const char * compression;
+    /** SHA-256 of the stored data in hex, empty if it was not read **/
+    std::string sha256;
+};
+
+/** Consumer of the events **/
+class EventSink {
+public:
+    virtual ~EventSink() {}
+    /** Handle an event, may be called from several threads **/
+    virtual void emit(const Event &event)=0;
+    /** Whether the stored data of files should be hashed **/
+    virtual bool wantsHashes() const { return false; }
+};
+
+/** Renders files as lines of a table: offset, size, compression, path **/
+class TextEventSink : public EventSink {
+public:
+    explicit TextEventSink(std::ostream &output) : output(output) {}
+    void emit(const Event &event) override;
+    
+private:
+    std::ostream &output;
+};
+
+/** Writes every event as a line of JSON (NDJSON) **/
+class JsonEventSink : public EventSink {
+public:
+    explicit JsonEventSink(std::ostream &output) : output(output) {}
+    ~JsonEventSink();
+    void emit(const Event &event) override;
+    bool wantsHashes() const override { return true; }
+    
+private:
+    /** Output is written in chunks of this size **/
+    static constexpr size_t BUFFER_SIZE=64*1024;
+    
+    std::ostream &output;
+    std::mutex mutex;
+    std::string buffer;
+};
+
+/** Append `value` to `out` as a JSON string **/
+void appendJSONString(std::string &out, const std::string &value);
+/** The bytes in lowercase hex **/
+std::string toHex(const void * data, size_t length);
+/** SHA-256 of the bytes in hex **/
+std::string sha256(const Span &data);
+
+/** SHA-256 of a stream of bytes **/
+class Hasher {
+public:
+    Hasher();
+    ~Hasher();
+    void update(const void * data, size_t length);
+    /** The hash in hex, nothing can be added afterwards **/
+    std::string finish();
+    
+private:
+    Hasher(const Hasher &other)=delete;
+    Hasher &operator =(const Hasher &other)=delete;
+    
+    evp_md_ctx_st * context;
+};
+
+#endif
@@ -0,0 +1,89 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Events.hpp"
+#include "Incremental.hpp"
+#include "REUtils.hpp"
+
+using std::string;
+
+/******************************************************************************/
+
+/** Size and modification time of the file, false if it does not exist **/
+static bool getStatus(const string &path, uint64_t &size, string &modified) {
+    struct stat st;
+    if (stat(path.c_str(), &st)<0)
+        return false;
+    size=st.st_size;
+    modified=std::to_string(st.st_mtim.tv_sec)+'.'+std::to_string(st.st_mtim.tv_nsec);
+    return true;
+}
+
+/******************************************************************************/
+
+Incremental::Incremental(const string &path) : path(path), skipped(0) {
+    // A line per output: offset, length, size, modification time, hash and path
+    std::ifstream saved(path);
+    string line;
+    while (std::getline(saved, line)) {
+        std::istringstream fields(line);
+        Output output;
+        string name;
+        if ((fields >> output.offset >> output.length >> output.size >> output.modified >> output.hash)&&
+                (fields.get()==' ')&&std::getline(fields, name))
+            outputs[name]=output;
+    }
+}
+
+Incremental::~Incremental() {
+    string temporary=path+".tmp"+std::to_string(getpid());
+    std::ofstream state(temporary, std::ios::trunc);
+    for (auto i=outputs.begin(); i!=outputs.end(); ++i) {
+        // Outputs of this run are taken as they are now
+        if (i->second.modified.empty()&&!getStatus(i->first, i->second.size, i->second.modified))
+            continue;
+        state << i->second.offset << ' ' << i->second.length << ' ' << i->second.size << ' ' <<
+            i->second.modified << ' ' << i->second.hash << ' ' << i->first << '\n';
+    }
+    if (state.flush())
+        rename(temporary.c_str(), path.c_str());
+    else
+        unlink(temporary.c_str());
+}
+
+bool Incremental::isUnchanged(const string &path, const BinaryReader &source, string &hash) {
+    Output saved;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto output=outputs.find(path);
+        if ((output==outputs.end())||(output->second.offset!=uint64_t(source.debug()))||
+                (output->second.length!=source.available()))
+            return false;
+        saved=output->second;
+    }
+    
+    // The file must not have been changed or removed since, and only then
+    // the source is read to compare its hash
+    uint64_t size;
+    string modified;
+    if (!getStatus(path, size, modified)||(size!=saved.size)||(modified!=saved.modified))
+        return false;
+    hash=sha256(source.span(source.tell(), source.available()));
+    if (hash!=saved.hash)
+        return false;
+    std::lock_guard<std::mutex> lock(mutex);
+    skipped++;
+    return true;
+}
+
+void Incremental::record(const string &path, const BinaryReader &source, const string &hash) {
+    string sourceHash=hash.empty()?sha256(source.span(source.tell(), source.available())):hash;
+    std::lock_guard<std::mutex> lock(mutex);
+    outputs[path]=Output {uint64_t(source.debug()), source.available(), sourceHash, 0, string()};
+}
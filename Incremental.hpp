@@ -0,0 +1,51 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#ifndef __INCREMENTAL_HPP
+#define __INCREMENTAL_HPP
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+class BinaryReader;
+
+/** Outputs of earlier runs, so that the files which would be written again
+    with the same contents are skipped. Every output is recorded with the
+    region of the input it comes from, the hash of that region and the size
+    and modification time of the written file **/
+class Incremental {
+public:
+    /** Load the state saved in `path`, if any **/
+    explicit Incremental(const std::string &path);
+    /** Save the state, also after a failed run, which keeps the finished outputs **/
+    ~Incremental();
+    /** Whether `path` was written from the rest of `source` and was not
+        changed since. The path, the region and the file are compared first;
+        only if they match is the source hashed, and `hash` is set for record() **/
+    bool isUnchanged(const std::string &path, const BinaryReader &source, std::string &hash);
+    /** Remember that `path` was written from the rest of `source` with this
+        hash, which is computed here if empty **/
+    void record(const std::string &path, const BinaryReader &source, const std::string &hash);
+    /** Number of outputs which were skipped **/
+    unsigned getSkipped() const { return skipped; }
+    
+private:
+    struct Output {
+        uint64_t offset;
+        uint64_t length;
+        std::string hash;
+        /** Size and modification time of the file, taken when the state is saved **/
+        uint64_t size;
+        std::string modified;
+    };
+    
+    std::string path;
+    std::mutex mutex;
+    std::map<std::string, Output> outputs;
+    unsigned skipped;
+};
+
+#endif
@@ -0,0 +1,253 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include "Index.hpp"
+
+using std::string;
+
+/******************************************************************************/
+
+/** Collects the events of listing **/
+class IndexBuilder : public EventSink {
+public:
+    explicit IndexBuilder(Index &index) : index(index) {}
+    void emit(const Event &event) override { index.add(event); }
+    
+private:
+    Index &index;
+};
+
+/** Passes the contents to a sink owned by somebody else **/
+class SinkReference : public Sink {
+public:
+    explicit SinkReference(Sink &target) : target(target) {}
+    void write(const void * data, size_t length) override { target.write(data, length); }
+    
+private:
+    Sink &target;
+};
+
+/** Paths are given relative to the top of the container, with or without the leading slash **/
+static string normalize(const string &path) {
+    size_t start=path.find_first_not_of('/');
+    return start==string::npos?string():path.substr(start);
+}
+
+/** Pattern which matches only `path` **/
+static string escape(const string &path) {
+    string pattern;
+    for (auto i=path.begin(); i!=path.end(); ++i) {
+        if ((*i=='*')||(*i=='?')||(*i=='[')||(*i=='\\'))
+            pattern+='\\';
+        pattern+=*i;
+    }
+    return pattern;
+}
+
+static const uint64_t INDEX_MAGIC=0x5844494B43415055ULL;  // "UPACKIDX"
+/** Changes when the format of saved indexes or the events of listing change **/
+static const uint64_t INDEX_VERSION=1;
+
+static void writeInteger(std::ostream &output, uint64_t value) {
+    output.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void writeString(std::ostream &output, const string &value) {
+    writeInteger(output, value.size());
+    output.write(value.data(), value.size());
+}
+
+static uint64_t readInteger(std::istream &input) {
+    uint64_t value;
+    if (!input.read(reinterpret_cast<char *>(&value), sizeof(value)))
+        throw "damaged saved index";
+    return value;
+}
+
+static string readString(std::istream &input) {
+    uint64_t length=readInteger(input);
+    if (length>(1U<<20))
+        throw "damaged saved index";
+    string value(length, '\0');
+    if (!input.read(&value[0], length))
+        throw "damaged saved index";
+    return value;
+}
+
+/** Names of formats and codecs of loaded indexes, which are kept as C strings **/
+static const char * intern(const string &value) {
+    static std::mutex mutex;
+    static std::set<string> strings;
+    std::lock_guard<std::mutex> lock(mutex);
+    return strings.insert(value).first->c_str();
+}
+
+/******************************************************************************/
+
+Index::Index(const BinaryReader &is, const string &name, const Unpacker &unpacker) :
+        is(is), name(name), unpacker(unpacker) {
+    IndexBuilder builder(*this);
+    Unpacker lister(unpacker);
+    lister.setListing(true);
+    lister.setEvents(&builder);
+    BinaryReader input(this->is);
+    format=lister.unpack(input, name, [](const Event &entry) {
+        return std::unique_ptr<Sink>();
+    });
+}
+
+Index::Index(const BinaryReader &is, const string &name, const Unpacker &unpacker, std::istream &saved) :
+        is(is), name(name), unpacker(unpacker) {
+    if ((readInteger(saved)!=INDEX_MAGIC)||(readInteger(saved)!=INDEX_VERSION))
+        throw "not a saved index";
+    format=intern(readString(saved));
+    for (uint64_t i=0, count=readInteger(saved); i<count; i++) {
+        Event event;
+        event.type=Event::Type(readInteger(saved));
+        event.name=readString(saved);
+        event.path=readString(saved);
+        event.offset=readInteger(saved);
+        event.size=readInteger(saved);
+        string compression=readString(saved);
+        event.compression=compression.empty()?nullptr:intern(compression);
+        if (event.type>Event::FILE)
+            throw "damaged saved index";
+        add(event);
+    }
+}
+
+void Index::write(std::ostream &output) const {
+    writeInteger(output, INDEX_MAGIC);
+    writeInteger(output, INDEX_VERSION);
+    writeString(output, format);
+    writeInteger(output, events.size());
+    for (auto i=events.begin(); i!=events.end(); ++i) {
+        writeInteger(output, i->type);
+        writeString(output, i->name);
+        writeString(output, i->path);
+        writeInteger(output, i->offset);
+        writeInteger(output, i->size);
+        writeString(output, i->compression?i->compression:"");
+    }
+}
+
+void Index::add(const Event &event) {
+    events.push_back(event);
+    if ((event.type==Event::CONTAINER)&&!event.path.empty())
+        nested.push_back(event.path+'/');
+    if (event.type!=Event::FILE)
+        return;
+    
+    // Files inside nested containers are at offsets of the unpacked
+    // container, and files reported in pieces are not stored as a whole
+    bool stored=!event.compression;
+    for (auto i=nested.begin(); i!=nested.end(); ++i)
+        if (event.path.compare(0, i->size(), *i)==0)
+            stored=false;
+    auto i=paths.find(event.path);
+    if (i!=paths.end())
+        i->second.stored=false;
+    else
+        paths.emplace(event.path, Location {entries.size(), stored});
+    entries.push_back(event);
+}
+
+bool Index::replay(EventSink &sink, const Context &context) const {
+    if (context.selectsIds())
+        return false;
+    for (auto i=events.begin(); i!=events.end(); ++i) {
+        if ((i->type==Event::FILE)&&!context.wants(i->path))
+            continue;
+        if ((i->type==Event::DIRECTORY)&&!context.wantsDirectory(i->path))
+            continue;
+        Event event(*i);
+        event.path=event.path.empty()?context.getOutputDir():context.getPath(event.path);
+        sink.emit(event);
+    }
+    return true;
+}
+
+bool Index::extract(const Context &context) const {
+    if (context.selectsIds())
+        return false;
+    for (auto i=paths.begin(); i!=paths.end(); ++i)
+        if (!i->second.stored&&context.wants(i->first))
+            return false;
+    
+    context.createDirectory();
+    for (auto i=entries.begin(); i!=entries.end(); ++i) {
+        if (!context.wants(i->path))
+            continue;
+        
+        // Create the directories on the way to the file
+        for (size_t slash=i->path.find('/'); slash!=string::npos; slash=i->path.find('/', slash+1))
+            Context(context, i->path.substr(0, slash)).createDirectory();
+        BinaryReader contents(is, i->offset-is.debug(), i->size);
+        context.addEntry(i->path, contents);
+        if (!context.isListing())
+            context.write(contents, i->path);
+    }
+    return true;
+}
+
+const Event * Index::find(const string &path) const {
+    auto i=paths.find(normalize(path));
+    return i==paths.end()?nullptr:&entries[i->second.index];
+}
+
+void Index::open(const string &path, Sink &sink) const {
+    string relative=normalize(path);
+    auto i=paths.find(relative);
+    if (i==paths.end())
+        throw "no such file: "+path;
+    
+    // Only the payload is read if it is stored as is
+    if (i->second.stored) {
+        const Event &entry=entries[i->second.index];
+        BinaryReader contents(is, entry.offset-is.debug(), entry.size);
+        contents.extract(sink);
+        return;
+    }
+    
+    // Otherwise only the directories on the way to the file are walked
+    auto filter=std::make_shared<Filter>();
+    filter->include(escape(relative));
+    Unpacker reader(unpacker);
+    reader.setListing(false);
+    reader.setFilter(filter);
+    reader.setEvents(nullptr);
+    bool found=false;
+    BinaryReader input(is);
+    reader.unpack(input, name, [&](const Event &entry) {
+        if (entry.path!=relative)
+            return std::unique_ptr<Sink>();
+        found=true;
+        return std::unique_ptr<Sink>(new SinkReference(sink));
+    });
+    if (!found)
+        throw "cannot unpack "+path;
+}
+
+bool Index::isStored(const string &path) const {
+    auto i=paths.find(normalize(path));
+    return (i!=paths.end())&&i->second.stored;
+}
+
+size_t Index::read(const string &path, void * buffer, size_t length, uint64_t offset) const {
+    auto i=paths.find(normalize(path));
+    if ((i==paths.end())||!i->second.stored)
+        throw "not a stored file: "+path;
+    
+    const Event &entry=entries[i->second.index];
+    if (offset>=entry.size)
+        return 0;
+    length=std::min<uint64_t>(length, entry.size-offset);
+    Span data=is.span(entry.offset-is.debug()+offset, length);
+    memcpy(buffer, data.data(), length);
+    return length;
+}
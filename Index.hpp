@@ -0,0 +1,75 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#ifndef __INDEX_HPP
+#define __INDEX_HPP
+
+#include <istream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Unpacker.hpp"
+
+/** Entries of a container, found without reading their contents, which can
+    then be read one by one **/
+class Index {
+public:
+    /** Index the rest of `is`; `name` is used to detect the format by
+        extension. `unpacker` gives the type, recursion and log options **/
+    Index(const BinaryReader &is, const std::string &name, const Unpacker &unpacker=Unpacker());
+    /** Index of `is` saved with write(), throws if `saved` is damaged **/
+    Index(const BinaryReader &is, const std::string &name, const Unpacker &unpacker, std::istream &saved);
+    /** Save the index in a compact binary form **/
+    void write(std::ostream &output) const;
+    /** Name of the format of the container **/
+    const char * getFormat() const { return format; }
+    /** Files in the order they were found **/
+    const std::vector<Event> &getEntries() const { return entries; }
+    /** Report the events of listing again to `sink`, with the paths in the
+        output directory of `context` and only the files and directories its
+        filter selects. The index has no ids, so returns false without
+        reporting anything if the filter selects ids **/
+    bool replay(EventSink &sink, const Context &context) const;
+    /** Unpack the files selected by `context` straight from their offsets if
+        all of them are stored as is; returns false without unpacking anything
+        otherwise, also if the filter selects ids **/
+    bool extract(const Context &context) const;
+    /** File at `path` (relative to the top of the container), nullptr if there is none **/
+    const Event * find(const std::string &path) const;
+    /** Write the contents of the file at `path` to `sink` as unpacking would
+        save them. Files stored as is are copied straight from the input,
+        others are unpacked with everything but `path` skipped **/
+    void open(const std::string &path, Sink &sink) const;
+    /** Whether the file at `path` is stored as is, so that it can be read in parts **/
+    bool isStored(const std::string &path) const;
+    /** Read up to `length` bytes at `offset` of a file stored as is,
+        return the number of bytes read **/
+    size_t read(const std::string &path, void * buffer, size_t length, uint64_t offset) const;
+    
+private:
+    friend class IndexBuilder;
+    
+    /** Position of a file in `entries` and whether its contents are stored
+        as is at its offset in the input **/
+    struct Location {
+        size_t index;
+        bool stored;
+    };
+    
+    void add(const Event &event);
+    
+    BinaryReader is;
+    std::string name;
+    Unpacker unpacker;
+    const char * format;
+    /** Everything found when listing, including containers and directories **/
+    std::vector<Event> events;
+    std::vector<Event> entries;
+    /** Nested containers, whose files are at offsets of the unpacked data **/
+    std::vector<std::string> nested;
+    std::map<std::string, Location> paths;
+};
+
+#endif
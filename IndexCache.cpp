@@ -0,0 +1,114 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <openssl/evp.h>
+#include <sstream>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include "IndexCache.hpp"
+#include "TypeRegistration.hpp"
+
+using std::string;
+
+/******************************************************************************/
+
+/** Create the directory and its parents, ignoring errors **/
+static void makeDirectories(const string &path) {
+    for (size_t slash=path.find('/', 1); slash!=string::npos; slash=path.find('/', slash+1))
+        mkdir(path.substr(0, slash).c_str(), 0700);
+    mkdir(path.c_str(), 0700);
+}
+
+/** Replace the file at `path` at once, so that other processes never see a part of it **/
+static void saveFile(const string &path, const string &contents) {
+    string temporary=path+".tmp"+std::to_string(getpid())+'.'+
+        std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    std::ofstream output(temporary, std::ios::binary|std::ios::trunc);
+    if (output.write(contents.data(), contents.size())&&output.flush())
+        rename(temporary.c_str(), path.c_str());
+    else
+        unlink(temporary.c_str());
+}
+
+/******************************************************************************/
+
+IndexCache::IndexCache(const string &directory) : directory(directory) {}
+
+string IndexCache::getDefaultDirectory() {
+    const char * cache=getenv("XDG_CACHE_HOME");
+    if (cache&&*cache)
+        return string(cache)+"/unpacker";
+    const char * home=getenv("HOME");
+    return string(home?home:".")+"/.cache/unpacker";
+}
+
+string IndexCache::getContentHash(upp::File &file, const BinaryReader &is) {
+    struct stat st;
+    if (fstat(file.get(), &st)<0)
+        throw "fstat()";
+
+    // The hash is remembered for the identity of the file
+    string identity=std::to_string(st.st_size)+' '+std::to_string(st.st_mtim.tv_sec)+'.'+
+        std::to_string(st.st_mtim.tv_nsec)+' '+std::to_string(is.debug())+' ';
+    string idPath=directory+"/ids/"+std::to_string(st.st_dev)+'-'+std::to_string(st.st_ino);
+    std::ifstream saved(idPath);
+    string line;
+    if (std::getline(saved, line)&&(line.compare(0, identity.size(), identity)==0))
+        return line.substr(identity.size());
+
+    // BLAKE2b is the fastest hash of OpenSSL
+    EVP_MD_CTX * context=EVP_MD_CTX_new();
+    if (!context||(EVP_DigestInit_ex(context, EVP_blake2b512(), nullptr)!=1)) {
+        EVP_MD_CTX_free(context);
+        throw "EVP_DigestInit_ex()";
+    }
+    static const size_t CHUNK_SIZE=1024*1024;
+    for (size_t offset=0; offset<is.getSize(); offset+=CHUNK_SIZE) {
+        Span chunk=is.span(offset, std::min(CHUNK_SIZE, is.getSize()-offset));
+        EVP_DigestUpdate(context, chunk.data(), chunk.size());
+    }
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned length=0;
+    EVP_DigestFinal_ex(context, digest, &length);
+    EVP_MD_CTX_free(context);
+
+    // Half of the digest is more than enough to tell the inputs apart
+    string hash=toHex(digest, length/2);
+
+    makeDirectories(directory+"/ids");
+    saveFile(idPath, identity+hash+'\n');
+    return hash;
+}
+
+std::unique_ptr<Index> IndexCache::get(upp::File &file, const BinaryReader &is, const string &name,
+        const Unpacker &unpacker) {
+    // The format may be detected by the extension, and the options change the entries
+    string base=name.substr(name.rfind('/')+1);
+    string extension=base.substr(std::min(base.size(), base.rfind('.')));
+    string path=directory+'/'+getContentHash(file, is)+'-'+std::to_string(getRecursionDepth())+
+        (unpacker.getType().empty()?extension:'-'+unpacker.getType())+".idx";
+
+    std::ifstream saved(path, std::ios::binary);
+    if (saved) {
+        try {
+            return std::unique_ptr<Index>(new Index(is, name, unpacker, saved));
+        }
+        catch (const char * error) {
+            // Built again below
+        }
+    }
+
+    std::unique_ptr<Index> index(new Index(is, name, unpacker));
+    std::ostringstream output;
+    index->write(output);
+    makeDirectories(directory);
+    saveFile(path, output.str());
+    return index;
+}
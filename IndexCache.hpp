@@ -0,0 +1,35 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#ifndef __INDEXCACHE_HPP
+#define __INDEXCACHE_HPP
+
+#include <memory>
+#include <string>
+#include <unix++/File.hpp>
+#include "Index.hpp"
+
+/** Indexes of inputs saved in a directory, so that listing them again,
+    unpacking some of their files or printing one does not parse them.
+    An index is found by the hash of the contents of the input, which is
+    remembered for its identity (device, inode, size and modification time)
+    so that an unchanged file is not hashed again **/
+class IndexCache {
+public:
+    explicit IndexCache(const std::string &directory=getDefaultDirectory());
+    /** $XDG_CACHE_HOME/unpacker or ~/.cache/unpacker **/
+    static std::string getDefaultDirectory();
+    /** Index of `is`, read from `file`: loaded if it was saved for the same
+        contents and options, built and saved otherwise **/
+    std::unique_ptr<Index> get(upp::File &file, const BinaryReader &is, const std::string &name,
+        const Unpacker &unpacker);
+
+private:
+    /** Hash of the contents of the input, hashed only if the file changed **/
+    std::string getContentHash(upp::File &file, const BinaryReader &is);
+
+    std::string directory;
+};
+
+#endif
@@ -0,0 +1,230 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#include "Mount.hpp"
+
+#ifdef WITH_FUSE
+#define FUSE_USE_VERSION 31
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <fcntl.h>
+#include <fuse.h>
+#include <list>
+#include <mutex>
+#include <set>
+#include <sys/stat.h>
+#include <unordered_map>
+
+using std::string;
+
+/******************************************************************************/
+
+/** Decoded files, the least recently used are dropped first **/
+class DecodedCache {
+public:
+    using Data=std::shared_ptr<const ByteArray>;
+    
+    explicit DecodedCache(size_t capacity) : capacity(capacity), size(0) {}
+    /** Contents of the file at `path`, nullptr if they are not cached **/
+    Data get(const string &path) {
+        auto i=index.find(path);
+        if (i==index.end())
+            return nullptr;
+        entries.splice(entries.begin(), entries, i->second);
+        return i->second->second;
+    }
+    /** Keep the contents of the file at `path`, dropping the oldest ones if needed **/
+    void put(const string &path, const Data &data) {
+        entries.emplace_front(path, data);
+        index[path]=entries.begin();
+        size+=data->size();
+        while ((size>capacity)&&(entries.size()>1)) {
+            size-=entries.back().second->size();
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+    
+private:
+    size_t capacity;
+    size_t size;
+    std::list<std::pair<string, Data>> entries;
+    std::unordered_map<string, std::list<std::pair<string, Data>>::iterator> index;
+};
+
+/** Directory tree of the index and the state shared by the FUSE callbacks **/
+struct MountState {
+    MountState(const Index &index, size_t cacheSize) : index(index), cache(cacheSize) {
+        directories[string()];
+        for (auto i=index.getEntries().begin(); i!=index.getEntries().end(); ++i) {
+            const string &path=i->path;
+            files.emplace(path, &*i);
+            for (size_t slash=path.find('/'), start=0; ; start=slash+1, slash=path.find('/', start)) {
+                string parent=start?path.substr(0, start-1):string();
+                if (slash==string::npos) {
+                    directories[parent].insert(path.substr(start));
+                    break;
+                }
+                directories[parent].insert(path.substr(start, slash-start));
+            }
+        }
+    }
+    
+    const Index &index;
+    /** Names in every directory, the root is "" **/
+    std::unordered_map<string, std::set<string>> directories;
+    std::unordered_map<string, const Event *> files;
+    /** Protects the cache, the decoded sizes and the files being decoded,
+        not the decoding itself **/
+    std::mutex mutex;
+    DecodedCache cache;
+    /** Sizes of the files which were decoded, the index only has the stored ones **/
+    std::unordered_map<string, uint64_t> decodedSizes;
+    /** Files being decoded by some thread, others opening them wait for it **/
+    std::set<string> decoding;
+    std::condition_variable decoded;
+};
+
+static MountState &getState() {
+    return *static_cast<MountState *>(fuse_get_context()->private_data);
+}
+
+/** Path relative to the top of the container **/
+static string relative(const char * path) {
+    return path+strspn(path, "/");
+}
+
+static int getAttributes(const char * path, struct stat * st, struct fuse_file_info * fi) {
+    MountState &state=getState();
+    string name=relative(path);
+    memset(st, 0, sizeof(*st));
+    
+    if (state.directories.count(name)) {
+        st->st_mode=S_IFDIR|0555;
+        st->st_nlink=2;
+        return 0;
+    }
+    
+    auto file=state.files.find(name);
+    if (file==state.files.end())
+        return -ENOENT;
+    st->st_mode=S_IFREG|0444;
+    st->st_nlink=1;
+    st->st_size=file->second->size;
+    if (!state.index.isStored(name)) {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        auto decoded=state.decodedSizes.find(name);
+        if (decoded!=state.decodedSizes.end())
+            st->st_size=decoded->second;
+    }
+    return 0;
+}
+
+static int readDirectory(const char * path, void * buffer, fuse_fill_dir_t filler, off_t offset,
+        struct fuse_file_info * fi, enum fuse_readdir_flags flags) {
+    MountState &state=getState();
+    auto directory=state.directories.find(relative(path));
+    if (directory==state.directories.end())
+        return -ENOENT;
+    
+    filler(buffer, ".", nullptr, 0, fuse_fill_dir_flags(0));
+    filler(buffer, "..", nullptr, 0, fuse_fill_dir_flags(0));
+    for (auto i=directory->second.begin(); i!=directory->second.end(); ++i)
+        filler(buffer, i->c_str(), nullptr, 0, fuse_fill_dir_flags(0));
+    return 0;
+}
+
+static int openFile(const char * path, struct fuse_file_info * fi) {
+    MountState &state=getState();
+    string name=relative(path);
+    if (!state.files.count(name))
+        return -ENOENT;
+    if ((fi->flags&O_ACCMODE)!=O_RDONLY)
+        return -EACCES;
+    if (state.index.isStored(name))
+        return 0;
+    
+    // Other files are decoded as a whole when opened; their size is not
+    // known beforehand, so reads bypass the page cache
+    DecodedCache::Data data;
+    {
+        std::unique_lock<std::mutex> lock(state.mutex);
+        state.decoded.wait(lock, [&]() { return !state.decoding.count(name); });
+        data=state.cache.get(name);
+        if (!data)
+            state.decoding.insert(name);
+    }
+    if (!data) {
+        // Without the lock, so that other files are opened and read meanwhile
+        try {
+            auto contents=std::make_shared<ByteArray>();
+            BufferSink sink(*contents);
+            state.index.open(name, sink);
+            data=contents;
+        }
+        catch (...) {}
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            state.decoding.erase(name);
+            if (data) {
+                state.decodedSizes[name]=data->size();
+                state.cache.put(name, data);
+            }
+        }
+        state.decoded.notify_all();
+        if (!data)
+            return -EIO;
+    }
+    fi->fh=reinterpret_cast<uint64_t>(new DecodedCache::Data(data));
+    fi->direct_io=1;
+    return 0;
+}
+
+static int readFile(const char * path, char * buffer, size_t length, off_t offset, struct fuse_file_info * fi) {
+    if (fi->fh) {
+        const ByteArray &data=**reinterpret_cast<DecodedCache::Data *>(fi->fh);
+        if (size_t(offset)>=data.size())
+            return 0;
+        length=std::min(length, data.size()-offset);
+        memcpy(buffer, data.data()+offset, length);
+        return length;
+    }
+    
+    try {
+        return getState().index.read(relative(path), buffer, length, offset);
+    }
+    catch (...) {
+        return -EIO;
+    }
+}
+
+static int releaseFile(const char * path, struct fuse_file_info * fi) {
+    delete reinterpret_cast<DecodedCache::Data *>(fi->fh);
+    return 0;
+}
+
+int mount(const Index &index, const string &mountPoint, size_t cacheSize) {
+    MountState state(index, cacheSize);
+    struct fuse_operations operations;
+    memset(&operations, 0, sizeof(operations));
+    operations.getattr=getAttributes;
+    operations.readdir=readDirectory;
+    operations.open=openFile;
+    operations.read=readFile;
+    operations.release=releaseFile;
+    
+    // In the foreground, until unmounted or interrupted
+    const char * arguments[]={"unpacker", "-f", "-o", "ro,fsname=unpacker", mountPoint.c_str()};
+    int count=sizeof(arguments)/sizeof(arguments[0]);
+    return fuse_main(count, const_cast<char **>(arguments), &operations, &state);
+}
+
+#else
+
+int mount(const Index &index, const std::string &mountPoint, size_t cacheSize) {
+    throw "built without FUSE support, rebuild with `make WITH_FUSE=1`";
+}
+
+#endif
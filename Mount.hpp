@@ -0,0 +1,22 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#ifndef __MOUNT_HPP
+#define __MOUNT_HPP
+
+#include <cstddef>
+#include <string>
+#include "Index.hpp"
+
+/** Default limit of the decoded files kept in memory **/
+static constexpr size_t DEFAULT_MOUNT_CACHE_SIZE=256*1024*1024;
+
+/** Serve the files of `index` as a read-only file system at `mountPoint`
+    until it is unmounted. Files stored as is are read from the input on
+    demand; others are decoded when opened and the most recently used of
+    them are kept, up to `cacheSize` bytes. Returns the exit status of FUSE;
+    throws if the program was built without FUSE (make WITH_FUSE=1) **/
+int mount(const Index &index, const std::string &mountPoint, size_t cacheSize=DEFAULT_MOUNT_CACHE_SIZE);
+
+#endif
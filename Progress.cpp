@@ -0,0 +1,129 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#include <chrono>
+#include <cstdio>
+#include <unistd.h>
+#include "Progress.hpp"
+#include "REUtils.hpp"
+
+using std::string;
+
+/******************************************************************************/
+
+/** Interval between the updates **/
+static const std::chrono::milliseconds INTERVAL(250);
+/** Slowest rate in bytes per second for which the time left is estimated **/
+static const double MIN_RATE=1024;
+/** Longest time left in seconds which is printed **/
+static const double MAX_ETA=100*3600;
+/** Longest path printed on a terminal, longer ones keep their end **/
+static const size_t MAX_ENTRY=48;
+
+/** Progress which is being reported, if any **/
+static Progress * active=nullptr;
+/** Input of the job running in this thread **/
+static thread_local const Source * input=nullptr;
+/** Furthest position of the input reached by the job **/
+static thread_local uint64_t reached=0;
+
+/******************************************************************************/
+
+Progress::Progress(int fd, uint64_t total) : fd(fd), terminal(isatty(fd)), total(total),
+        consumed(0), written(0), rate(0), previous(0), stopping(false) {
+    active=this;
+    thread=std::thread(&Progress::run, this);
+}
+
+Progress::~Progress() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping=true;
+    }
+    stop.notify_one();
+    thread.join();
+    active=nullptr;
+}
+
+void Progress::run() {
+    auto start=std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stop.wait_for(lock, INTERVAL, [this]() { return stopping; })) {
+        lock.unlock();
+        std::chrono::duration<double> elapsed=std::chrono::steady_clock::now()-start;
+        report(elapsed.count(), false);
+        lock.lock();
+    }
+    lock.unlock();
+    std::chrono::duration<double> elapsed=std::chrono::steady_clock::now()-start;
+    report(elapsed.count(), true);
+}
+
+void Progress::report(double seconds, bool last) {
+    uint64_t read=std::min(consumed.load(std::memory_order_relaxed), total);
+    double current=(read-previous)/std::chrono::duration<double>(INTERVAL).count();
+    rate=previous||rate?0.7*rate+0.3*current:current;
+    previous=read;
+    
+    char line[160];
+    int length=snprintf(line, sizeof(line), "%s%5.1f%%  %.1f of %.1f MB  %.1f MB/s  %.1f MB written  ",
+        terminal?"\r":"", total?100.0*read/total:100.0, read/1e6, total/1e6,
+        (last?(seconds>0?read/seconds:0):rate)/1e6, written.load(std::memory_order_relaxed)/1e6);
+    string text(line, std::min<size_t>(length, sizeof(line)-1));
+    
+    // Time left while running, time taken at the end; a stalled input has none
+    double left=last?seconds:rate>=MIN_RATE?(total-read)/rate:-1;
+    if (last||((left>=0)&&(left<MAX_ETA))) {
+        unsigned whole=left;
+        snprintf(line, sizeof(line), "%s %u:%02u", last?"took":"ETA", whole/60, whole%60);
+        text+=line;
+    }
+    else
+        text+="ETA -";
+    if (!last) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!entry.empty())
+            text+="  "+(terminal&&(entry.size()>MAX_ENTRY)?"..."+entry.substr(entry.size()-MAX_ENTRY):entry);
+    }
+    text+=terminal?(last?"\e[K\n":"\e[K"):"\n";
+    ::write(fd, text.data(), text.size());
+}
+
+/******************************************************************************/
+
+ProgressScope::ProgressScope(const BinaryReader &input) : previous(::input), previousReached(reached) {
+    ::input=input.getSource();
+    reached=0;
+}
+
+ProgressScope::~ProgressScope() {
+    // What the handler did not look at, e.g. padding at the end, is done too
+    if (active&&input)
+        progressReached(input, input->getSize());
+    input=previous;
+    reached=previousReached;
+}
+
+bool isProgressReported() {
+    return active;
+}
+
+void progressReached(const Source * source, uint64_t position) {
+    if (active&&(source==input)&&(position>reached)) {
+        active->consumed.fetch_add(position-reached, std::memory_order_relaxed);
+        reached=position;
+    }
+}
+
+void progressWritten(size_t bytes) {
+    if (active)
+        active->written.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void progressEntry(const string &path) {
+    if (active) {
+        std::lock_guard<std::mutex> lock(active->mutex);
+        active->entry=path;
+    }
+}
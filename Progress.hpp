@@ -0,0 +1,81 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#ifndef __PROGRESS_HPP
+#define __PROGRESS_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class BinaryReader;
+class Source;
+
+/** Progress of the extraction, redrawn by its own thread a few times a second:
+    bytes consumed from the inputs with the rate and the ETA, bytes written and
+    the file being unpacked. The workers only add to atomic counters. An input
+    is consumed up to the furthest position its handler has moved to, so that
+    looking at data again or ahead of time (e.g. to hash it or to detect its
+    type) does not count **/
+class Progress {
+public:
+    /** Report on the descriptor `fd` while `total` bytes of inputs are unpacked **/
+    Progress(int fd, uint64_t total);
+    ~Progress();
+    
+private:
+    Progress(const Progress &other)=delete;
+    Progress &operator =(const Progress &other)=delete;
+    friend void progressReached(const Source * source, uint64_t position);
+    friend void progressWritten(size_t bytes);
+    friend void progressEntry(const std::string &path);
+    
+    void run();
+    /** Print the line; `last` ends it instead of redrawing it next time **/
+    void report(double seconds, bool last);
+    
+    int fd;
+    bool terminal;
+    uint64_t total;
+    std::atomic<uint64_t> consumed, written;
+    /** Smoothed rate of consumption in bytes per second **/
+    double rate;
+    uint64_t previous;
+    std::mutex mutex;
+    std::condition_variable stop;
+    bool stopping;
+    std::string entry;
+    std::thread thread;
+};
+
+/** Makes `input` the input of the job in this thread while it exists: the
+    positions its handler reaches count as consumed, and so does the rest of
+    it when the job ends **/
+class ProgressScope {
+public:
+    explicit ProgressScope(const BinaryReader &input);
+    ~ProgressScope();
+    
+private:
+    ProgressScope(const ProgressScope &other)=delete;
+    ProgressScope &operator =(const ProgressScope &other)=delete;
+    
+    const Source * previous;
+    uint64_t previousReached;
+};
+
+/** Whether progress is reported **/
+bool isProgressReported();
+/** The cursor of a handler reached `position` of `source`, which counts if
+    it is the input of the job **/
+void progressReached(const Source * source, uint64_t position);
+/** `bytes` were written to the files **/
+void progressWritten(size_t bytes);
+/** The file at `path` is being unpacked **/
+void progressEntry(const std::string &path);
+
+#endif
@@ -2,9 +2,28 @@
  *  FPSX/ROFS unpacking program
  ******************************************************************************/
 
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <new>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <zlib.h>
+#include "AsyncIO.hpp"
+#include "Events.hpp"
+#include "Progress.hpp"
 #include "REUtils.hpp"
+#include "Statistics.hpp"
+#include "StringUtils.hpp"
 
 using std::string;
 using std::vector;
@@ -12,104 +31,339 @@ using std::wstring;
 
 /******************************************************************************/
 
-int ZEXPORT uncompress_(Bytef *dest, uLongf *destLen, const Bytef *source, uLong *sourceLen) {
-    z_stream stream;
-    int err;
-    const uInt max = (uInt)-1;
-    uLong len, left;
-    Byte buf[1];    /* for detection of incomplete stream when *destLen == 0 */
-
-    len = *sourceLen;
-    if (*destLen) {
-        left = *destLen;
-        *destLen = 0;
+/** Size of the output buffer of the decompressor **/
+static const size_t INFLATE_CHUNK_SIZE=256*1024;
+
+Inflater::Inflater(Sink &output, int windowBits) :
+        output(output), stream(new z_stream), buffer(INFLATE_CHUNK_SIZE), done(false) {
+    stream->next_in=Z_NULL;
+    stream->avail_in=0;
+    stream->zalloc=Z_NULL;
+    stream->zfree=Z_NULL;
+    stream->opaque=Z_NULL;
+    if (inflateInit2(stream, windowBits)!=Z_OK) {
+        delete stream;
+        throw "Z_MEM_ERROR";
     }
-    else {
-        left = 1;
-        dest = buf;
+}
+
+Inflater::~Inflater() {
+    inflateEnd(stream);
+    delete stream;
+}
+
+bool Inflater::update(const void * data, size_t length) {
+    const Bytef * in=static_cast<const Bytef *>(data);
+    
+    while (!done) {
+        // avail_in is 32-bit, so huge inputs are fed in slices
+        if ((stream->avail_in==0)&&length) {
+            stream->next_in=const_cast<Bytef *>(in);
+            stream->avail_in=std::min<size_t>(length, uInt(-1));
+            in+=stream->avail_in;
+            length-=stream->avail_in;
+        }
+        
+        stream->next_out=&buffer[0];
+        stream->avail_out=buffer.size();
+        int retval=inflate(stream, Z_NO_FLUSH);
+        size_t produced=buffer.size()-stream->avail_out;
+        if (produced)
+            output.write(&buffer[0], produced);
+        
+        if (retval==Z_STREAM_END)
+            done=true;
+        else if ((retval==Z_DATA_ERROR)||(retval==Z_NEED_DICT))
+            throw "Z_DATA_ERROR";
+        else if (retval==Z_MEM_ERROR)
+            throw "Z_MEM_ERROR";
+        else if ((retval!=Z_OK)&&(retval!=Z_BUF_ERROR))
+            throw "Z_UNKNOWN_ERROR";
+        else if ((stream->avail_in==0)&&(length==0)&&(produced<buffer.size()))
+            break;
     }
+    
+    return done;
+}
 
-    stream.next_in = (z_const Bytef *)source;
-    stream.avail_in = 0;
-    stream.zalloc = (alloc_func)0;
-    stream.zfree = (free_func)0;
-    stream.opaque = (voidpf)0;
+void Inflater::finish() {
+    if (!done)
+        throw "Z_BUF_ERROR";
+}
 
-    err = inflateInit(&stream);
-    printf("err1=%d\n", err);
-    if (err != Z_OK) return err;
+uint64_t Inflater::getTotalOut() const {
+    return stream->total_out;
+}
 
-    stream.next_out = dest;
-    stream.avail_out = 0;
+ByteArray uncompress(const ByteArray &inData, size_t uncompressedLengthHint) {
+    ByteArray outData;
+    outData.reserve(uncompressedLengthHint?uncompressedLengthHint:inData.size()*2);
+    BufferSink sink(outData);
+    uncompress(inData.data(), inData.size(), sink);
+    return outData;
+}
+
+void uncompress(const void * in, size_t length, Sink &output) {
+    PhaseTimer timer(Statistics::DECODE);
+    Inflater inflater(output);
+    inflater.update(in, length);
+    inflater.finish();
+}
+
+/******************************************************************************/
 
-    do {
-        if (stream.avail_out == 0) {
-            stream.avail_out = left > (uLong)max ? max : (uInt)left;
-            left -= stream.avail_out;
+/** Reads the file with pread() **/
+class FileSource : public Source {
+public:
+    explicit FileSource(upp::File &file) : file(file), size(file.seek(0, SEEK_END)) {}
+    size_t getSize() const override { return size; }
+    size_t read(void * buffer, size_t length, off_t offset) override {
+        size_t result=file.read(buffer, length, offset);
+        count(Statistics::PREADS);
+        count(Statistics::BYTES_READ, result);
+        return result;
+    }
+    int getDescriptor() const override { return file.get(); }
+    
+private:
+    upp::File &file;
+    size_t size;
+};
+
+/** Reads the file with pread() in large page-aligned blocks, so that
+    sequences of small reads are served from memory. The blocks are shared
+    by the threads reading the file, e.g. those serving a mounted container **/
+class CachedSource : public Source {
+public:
+    CachedSource(upp::File &file, size_t blockSize) :
+            file(file), size(file.seek(0, SEEK_END)), clock(0), statistics {0, 0, 0} {
+        size_t pageSize=sysconf(_SC_PAGESIZE);
+        this->blockSize=std::max(pageSize, (blockSize+pageSize-1)/pageSize*pageSize);
+        for (unsigned i=0; i<BLOCKS; i++) {
+            blocks[i].data=static_cast<uint8_t *>(aligned_alloc(pageSize, this->blockSize));
+            if (!blocks[i].data)
+                throw std::bad_alloc();
+            blocks[i].offset=-1;
+            blocks[i].length=0;
+            blocks[i].used=0;
         }
-        if (stream.avail_in == 0) {
-            stream.avail_in = len > (uLong)max ? max : (uInt)len;
-            len -= stream.avail_in;
+    }
+    ~CachedSource() {
+        for (unsigned i=0; i<BLOCKS; i++)
+            free(blocks[i].data);
+    }
+    size_t getSize() const override { return size; }
+    size_t read(void * buffer, size_t length, off_t offset) override {
+        if (length>=blockSize) {
+            // Large reads would only thrash the cache
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                statistics.bypasses++;
+            }
+            size_t result=file.read(buffer, length, offset);
+            count(Statistics::PREADS);
+            count(Statistics::BYTES_READ, result);
+            return result;
+        }
+        
+        std::lock_guard<std::mutex> lock(mutex);
+        uint8_t * out=static_cast<uint8_t *>(buffer);
+        size_t total=0;
+        while (total<length) {
+            const Block &block=fetch(offset+total);
+            size_t inBlock=offset+total-block.offset;
+            if (inBlock>=block.length)
+                break;
+            size_t chunk=std::min(length-total, block.length-inBlock);
+            memcpy(out+total, block.data+inBlock, chunk);
+            total+=chunk;
         }
-        err = inflate(&stream, Z_NO_FLUSH);
-    } while (err == Z_OK);
+        return total;
+    }
+    int getDescriptor() const override { return file.get(); }
+    CacheStatistics getCacheStatistics() const override {
+        std::lock_guard<std::mutex> lock(mutex);
+        return statistics;
+    }
+    
+private:
+    struct Block {
+        uint8_t * data;
+        off_t offset;
+        size_t length;
+        uint64_t used;
+    };
+    
+    /** Number of cached blocks, enough for a directory walker hopping
+        between a few regions of the file **/
+    static const unsigned BLOCKS=4;
+    
+    const Block &fetch(off_t position) {
+        off_t aligned=position/blockSize*blockSize;
+        Block * victim=&blocks[0];
+        for (unsigned i=0; i<BLOCKS; i++) {
+            if (blocks[i].offset==aligned) {
+                statistics.hits++;
+                blocks[i].used=++clock;
+                return blocks[i];
+            }
+            if (blocks[i].used<victim->used)
+                victim=&blocks[i];
+        }
+        
+        statistics.misses++;
+        victim->offset=aligned;
+        victim->length=file.read(victim->data, blockSize, aligned);
+        count(Statistics::PREADS);
+        count(Statistics::BYTES_READ, victim->length);
+        victim->used=++clock;
+        return *victim;
+    }
+    
+    upp::File &file;
+    size_t size;
+    size_t blockSize;
+    uint64_t clock;
+    Block blocks[BLOCKS];
+    CacheStatistics statistics;
+    mutable std::mutex mutex;
+};
+
+/** Maps the whole file into memory **/
+class MappedSource : public Source {
+public:
+    MappedSource(upp::File &file, void * address, size_t size) :
+        file(file), address(address), size(size) {}
+    ~MappedSource() {
+        munmap(address, size);
+    }
+    size_t getSize() const override { return size; }
+    size_t read(void * buffer, size_t length, off_t offset) override {
+        if (size_t(offset)>=size)
+            return 0;
+        if (length>size-offset)
+            length=size-offset;
+        memcpy(buffer, map()+offset, length);
+        return length;
+    }
+    const uint8_t * map() const override { return static_cast<const uint8_t *>(address); }
+    int getDescriptor() const override { return file.get(); }
+    
+private:
+    upp::File &file;
+    void * address;
+    size_t size;
+};
+
+static std::shared_ptr<Source> openSource(upp::File &file, BinaryReader::Backend backend, size_t blockSize) {
+    if (backend==BinaryReader::MMAP) {
+        off_t size=file.seek(0, SEEK_END);
+        if (size>0) {
+            void * address=mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file.get(), 0);
+            if (address!=MAP_FAILED)
+                return std::make_shared<MappedSource>(file, address, size);
+        }
+    }
+    if (backend==BinaryReader::PREAD)
+        return std::make_shared<FileSource>(file);
+    return std::make_shared<CachedSource>(file, blockSize);
+}
+
+size_t MemorySource::read(void * buffer, size_t length, off_t offset) {
+    if (size_t(offset)>=data.size())
+        return 0;
+    length=std::min(length, data.size()-offset);
+    memcpy(buffer, data.data()+offset, length);
+    return length;
+}
+
+struct SegmentedSource::Segments : std::map<off_t, BinaryReader> {
+    /** First segment which ends after `offset` or starts after it **/
+    iterator find(off_t offset) {
+        auto i=upper_bound(offset);
+        if ((i!=begin())&&(std::prev(i)->first+off_t(std::prev(i)->second.getSize())>offset))
+            --i;
+        return i;
+    }
+};
+
+SegmentedSource::SegmentedSource() : segments(new Segments), size(0) {}
 
-    *sourceLen -= len + stream.avail_in;
-    if (dest != buf)
-        *destLen = stream.total_out;
-    else if (stream.total_out && err == Z_BUF_ERROR)
-        left = 1;
+SegmentedSource::~SegmentedSource() {}
 
-    inflateEnd(&stream);
-    printf("err2=%d\n", err);
-    return err == Z_STREAM_END ? Z_OK :
-           err == Z_NEED_DICT ? Z_DATA_ERROR  :
-           err == Z_BUF_ERROR && left + stream.avail_out ? Z_DATA_ERROR :
-           err;
+void SegmentedSource::add(off_t offset, const BinaryReader &piece) {
+    BinaryReader data(piece, piece.tell(), piece.available());
+    off_t end=offset+data.getSize();
+    size=std::max(size, size_t(end));
+    
+    // Later pieces override earlier ones: cut the covered part out of them
+    for (auto i=segments->find(offset); (i!=segments->end())&&(i->first<end);) {
+        off_t from=i->first, to=from+i->second.getSize();
+        BinaryReader old=i->second;
+        i=segments->erase(i);
+        if (from<offset)
+            segments->emplace(from, BinaryReader(old, 0, offset-from));
+        if (to>end)
+            segments->emplace(end, BinaryReader(old, end-from, to-end));
+    }
+    if (data.getSize())
+        segments->emplace(offset, data);
 }
 
-ByteArray uncompress(const ByteArray &inData, size_t uncompressedLengthHint) {
-    if (0==uncompressedLengthHint)
-        uncompressedLengthHint=inData.size()*2;
+size_t SegmentedSource::read(void * buffer, size_t length, off_t offset) {
+    if (size_t(offset)>=size)
+        return 0;
+    length=std::min(length, size-offset);
     
-    uLongf outLength=uncompressedLengthHint;
-    ByteArray outData;
-    for (bool unpacked=false; !unpacked;) {
-        outData.resize(outLength);
-        size_t inLength=inData.size();
-        int retval=uncompress_(&outData[0], &outLength, &inData[0], &inLength);
-        if (retval==Z_OK) {
-            outData.resize(outLength);
-            unpacked=true;
-        }
-        else if (retval==Z_DATA_ERROR)
-            throw "Z_DATA_ERROR";
-        else if (retval==Z_MEM_ERROR)
-            throw "Z_MEM_ERROR";
-        else if (retval==Z_BUF_ERROR)
-            outLength+=outLength;
-        else
-            throw "Z_UNKNOWN_ERROR";
+    // Copy the segments in the range, filling the gaps with zeroes
+    uint8_t * out=static_cast<uint8_t *>(buffer);
+    off_t end=offset+length, filled=offset;
+    for (auto i=segments->find(offset); (i!=segments->end())&&(i->first<end); ++i) {
+        off_t from=std::max(offset, i->first);
+        off_t to=std::min<off_t>(end, i->first+i->second.getSize());
+        memset(out+(filled-offset), 0, from-filled);
+        Span piece=i->second.span(from-i->first, to-from);
+        memcpy(out+(from-offset), piece.data(), piece.size());
+        filled=to;
     }
-    return outData;
+    memset(out+(filled-offset), 0, end-filled);
+    return length;
+}
+
+/******************************************************************************/
+
+Span::Span(ByteArray &&bytes) {
+    auto owned=std::make_shared<const ByteArray>(std::move(bytes));
+    pointer=owned->data();
+    length=owned->size();
+    storage=std::move(owned);
 }
 
 /******************************************************************************/
 
-BinaryReader::BinaryReader(upp::File &file) :
-    file(file), start(0), offset(0), size(file.seek(0, SEEK_END)) {}
+BinaryReader::BinaryReader(upp::File &file, Backend backend, size_t blockSize) :
+    source(openSource(file, backend, blockSize)), mapping(source->map()), start(0), offset(0),
+    size(source->getSize()) {}
+
+BinaryReader::BinaryReader(std::shared_ptr<Source> source) :
+    source(std::move(source)), mapping(this->source->map()), start(0), offset(0),
+    size(this->source->getSize()) {}
 
 BinaryReader::BinaryReader(const BinaryReader &other) :
-    file(other.file), start(other.start+other.offset), offset(0), size(other.size) {}
+    source(other.source), mapping(other.mapping), start(other.start+other.offset),
+    offset(0), size(other.size) {}
 
 BinaryReader::BinaryReader(const BinaryReader &other, size_t length) :
-    file(other.file), start(other.start+other.offset), offset(0), size(length) {}
+    source(other.source), mapping(other.mapping), start(other.start+other.offset),
+    offset(0), size(length) {}
 
 BinaryReader::BinaryReader(const BinaryReader &other, off_t start, size_t length) :
-    file(other.file), start(other.start+start), offset(0), size(length) {}
+    source(other.source), mapping(other.mapping), start(other.start+start),
+    offset(0), size(length) {}
 
 BinaryReader::BinaryReader(const BinaryReader &other, off_t start, ToEnd marker) :
-    file(other.file), start(other.start+start), offset(0), size(other.size-start) {}
+    source(other.source), mapping(other.mapping), start(other.start+start),
+    offset(0), size(other.size-start) {}
 
 BinaryReader::~BinaryReader() {}
 
@@ -133,6 +387,7 @@ void BinaryReader::skip(unsigned bytes) {
     if (offset+bytes>size)
         throw "cannot skip bytes";
     offset+=bytes;
+    progressReached(source.get(), start+offset);
 }
 
 void BinaryReader::align(unsigned block) {
@@ -197,41 +452,231 @@ string BinaryReader::readShortUnicodeString() {
 }
 
 string BinaryReader::readUnicodeString(size_t length) {
-    string result(length, '\0');
-    for (unsigned i=0; i<length; i++) {
-        result[i]=readByte();
-        readByte();
-    }
-    return result;
+    ByteArray units(length*2);
+    read(units.data(), units.size());
+    return utf16ToUtf8(units.data(), length, false);
 }
 
 wstring BinaryReader::readWideString(size_t length) {
+    ByteArray units(length*2);
+    read(units.data(), units.size());
     wstring result(length, '\0');
-    for (unsigned i=0; i<length; i++)
-        result[i]=readShort();
+    for (size_t i=0; i<length; i++)
+        result[i]=(units[i*2]<<8)|units[i*2+1];
     return result;
 }
 
-void BinaryReader::extract(const string &destination, off_t offset, size_t length, bool truncate) {
+Span BinaryReader::span(off_t offset, size_t length) const {
+    if ((offset<0)||(size_t(offset)+length>size))
+        throw EOFException();
+    if (mapping) {
+        if (size_t(start+offset)+length>source->getSize())
+            throw EOFException();
+        return Span(mapping+start+offset, length, source);
+    }
+    ByteArray result(length);
+    if (length&&(source->read(&result[0], length, start+offset)<length))
+        throw EOFException();
+    return Span(std::move(result));
+}
+
+/** Size of a buffer used when the data cannot be copied by the kernel **/
+static const size_t COPY_CHUNK_SIZE=1024*1024;
+
+/** Share the extents between files (btrfs, xfs), the ranges must be aligned **/
+static bool cloneRange(int in, off_t &inOffset, int out, off_t &outOffset, size_t &length) {
+    struct stat st;
+    if (fstat(out, &st)<0)
+        return false;
+    size_t alignment=st.st_blksize?st.st_blksize:4096;
+    if ((inOffset%alignment)||(outOffset%alignment)||(length%alignment))
+        return false;
+    
+    file_clone_range range;
+    range.src_fd=in;
+    range.src_offset=inOffset;
+    range.src_length=length;
+    range.dest_offset=outOffset;
+    if (ioctl(out, FICLONERANGE, &range)<0)
+        return false;
+    inOffset+=length;
+    outOffset+=length;
+    length=0;
+    return true;
+}
+
+/** Copy inside the kernel; server-side copy on NFS and SMB **/
+static void copyFileRange(int in, off_t &inOffset, int out, off_t &outOffset, size_t &length) {
+    while (length) {
+        ssize_t copied=copy_file_range(in, &inOffset, out, &outOffset, length, 0);
+        if (copied<=0)
+            return;
+        length-=copied;
+    }
+}
+
+/** Copy inside the kernel with a page cache splice **/
+static void sendFile(int in, off_t &inOffset, int out, off_t &outOffset, size_t &length) {
+    if (lseek(out, outOffset, SEEK_SET)<0)
+        return;
+    while (length) {
+        ssize_t copied=sendfile(out, in, &inOffset, length);
+        if (copied<=0)
+            return;
+        outOffset+=copied;
+        length-=copied;
+    }
+}
+
+void BinaryReader::extract(const string &destination, off_t offset, size_t length, bool truncate,
+        Hasher * hasher) {
+    count(Statistics::EXTRACTS);
+    count(Statistics::BYTES_WRITTEN, length);
+    progressReached(source.get(), start+this->offset+length);
+    progressWritten(length);
+    off_t inOffset=start+this->offset;
+    if (inOffset+length>source->getSize())
+        throw EOFException();
+    
     int flags=O_WRONLY|O_CREAT;
     if (truncate)
         flags|=O_TRUNC;
     upp::File out(destination.c_str(), flags);
-    out.seek(offset);
-    string data(length, '\0');
-    read(&data[0], length);
-    out.write(data.data(), data.length());
+    off_t outOffset=offset;
+    size_t left=length;
+    SparseMode sparseMode=getSparseMode();
+    // The runs of a rewritten file replace those of the previous run
+    if (truncate)
+        resetErasedRuns(destination);
+    
+    // Try to avoid copying through the user space, from the cheapest method.
+    // Sparse files and hashing need to see the data.
+    int in=source->getDescriptor();
+    if ((sparseMode==SPARSE_NONE)&&!hasher&&(in>=0)&&left&&!cloneRange(in, inOffset, out.get(), outOffset, left)) {
+        copyFileRange(in, inOffset, out.get(), outOffset, left);
+        sendFile(in, inOffset, out.get(), outOffset, left);
+    }
+    
+    // Copy the rest in chunks of bounded size
+    if (left) {
+        out.seek(outOffset);
+        FileSink plainSink(out);
+        SparseSink sparseSink(out, outOffset, sparseMode==SPARSE_ERASED);
+        Sink &sink=sparseMode==SPARSE_NONE?static_cast<Sink &>(plainSink):sparseSink;
+        
+        ByteArray buffer(mapping?0:std::min(left, COPY_CHUNK_SIZE));
+        while (left) {
+            size_t chunk=std::min(left, COPY_CHUNK_SIZE);
+            const uint8_t * data=mapping+inOffset;
+            if (!mapping) {
+                if (source->read(&buffer[0], chunk, inOffset)<chunk)
+                    throw EOFException();
+                data=&buffer[0];
+            }
+            if (hasher)
+                hasher->update(data, chunk);
+            sink.write(data, chunk);
+            inOffset+=chunk;
+            left-=chunk;
+        }
+        
+        if (sparseMode!=SPARSE_NONE) {
+            sparseSink.finish();
+            sparseSink.saveErasedRuns(destination+".erased");
+        }
+    }
+    
+    this->offset+=length;
 }
 
-void BinaryReader::extract(const string &destination, bool truncate) {
+void BinaryReader::extract(const string &destination, bool truncate, Hasher * hasher) {
     off_t pos=tell();
-    extract(destination, pos, size-pos, truncate);
+    extract(destination, pos, size-pos, truncate, hasher);
+}
+
+void BinaryReader::extract(const string &destination, WriteQueue &queue) {
+    if (!queue.isAsync()||(getSparseMode()!=SPARSE_NONE)) {
+        extract(destination, true);
+        return;
+    }
+    
+    off_t inOffset=start+offset;
+    size_t length=size-offset;
+    if (inOffset+length>source->getSize())
+        throw EOFException();
+    
+    count(Statistics::EXTRACTS);
+    count(Statistics::BYTES_WRITTEN, length);
+    progressReached(source.get(), inOffset+length);
+    progressWritten(length);
+    auto out=queue.open(destination);
+    int in=source->getDescriptor();
+    if (mapping)
+        queue.write(out, Span(mapping+inOffset, length, source), 0);
+    else if (in>=0)
+        queue.copy(out, in, inOffset, length, 0);
+    else
+        queue.write(out, span(offset, length), 0);
+    offset+=length;
+}
+
+void BinaryReader::extract(Sink &sink, Hasher * hasher) {
+    count(Statistics::EXTRACTS);
+    off_t inOffset=start+offset;
+    size_t left=size-offset;
+    count(Statistics::BYTES_WRITTEN, left);
+    progressReached(source.get(), inOffset+left);
+    progressWritten(left);
+    if (inOffset+left>source->getSize())
+        throw EOFException();
+    
+    ByteArray buffer(mapping?0:std::min(left, COPY_CHUNK_SIZE));
+    while (left) {
+        size_t chunk=std::min(left, COPY_CHUNK_SIZE);
+        const uint8_t * data=mapping+inOffset;
+        if (!mapping) {
+            if (source->read(&buffer[0], chunk, inOffset)<chunk)
+                throw EOFException();
+            data=&buffer[0];
+        }
+        if (hasher)
+            hasher->update(data, chunk);
+        sink.write(data, chunk);
+        inOffset+=chunk;
+        left-=chunk;
+    }
+    offset=size;
+}
+
+void BinaryReader::extract(BlockSink &sink, off_t offset, size_t length) {
+    count(Statistics::EXTRACTS);
+    count(Statistics::BYTES_WRITTEN, length);
+    progressReached(source.get(), start+this->offset+length);
+    progressWritten(length);
+    off_t inOffset=start+this->offset;
+    if (inOffset+length>source->getSize())
+        throw EOFException();
+    
+    ByteArray buffer(mapping?0:std::min(length, COPY_CHUNK_SIZE));
+    for (size_t done=0; done<length;) {
+        size_t chunk=std::min(length-done, COPY_CHUNK_SIZE);
+        const uint8_t * data=mapping+inOffset+done;
+        if (!mapping) {
+            if (source->read(&buffer[0], chunk, inOffset+done)<chunk)
+                throw EOFException();
+            data=&buffer[0];
+        }
+        sink.write(data, chunk, offset+done);
+        done+=chunk;
+    }
+    this->offset+=length;
 }
 
 ByteArray BinaryReader::read(size_t maxLength) {
     ByteArray result(maxLength);
-    size_t nRead=file.read(&result[0], maxLength, offset+start);
+    size_t nRead=maxLength?source->read(&result[0], maxLength, offset+start):0;
     offset+=nRead;
+    progressReached(source.get(), start+offset);
     result.resize(nRead);
     return result;
 }
@@ -242,9 +687,33 @@ ByteArray BinaryReader::readAll() {
 
 void BinaryReader::read(void * buffer, size_t length) {
     if (length) {
-        size_t retval=file.read(buffer, length, offset+start);
+        size_t retval;
+        if (mapping) {
+            // Mapped input: copy directly without a virtual call or a syscall
+            size_t position=offset+start, total=source->getSize();
+            retval=position>=total?0:std::min(length, total-position);
+            memcpy(buffer, mapping+position, retval);
+        }
+        else
+            retval=source->read(buffer, length, offset+start);
         offset+=retval;
         if (retval<length)
             throw EOFException();
     }
 }
+
+/******************************************************************************/
+
+static thread_local std::ostream * consoleStream=nullptr;
+
+std::ostream &console() {
+    return consoleStream?*consoleStream:std::cout;
+}
+
+ConsoleRedirect::ConsoleRedirect(std::ostream &stream) : previous(consoleStream) {
+    consoleStream=&stream;
+}
+
+ConsoleRedirect::~ConsoleRedirect() {
+    consoleStream=previous;
+}
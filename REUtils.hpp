@@ -6,29 +6,149 @@
 #define __REUTILS_HPP
 
 #include <cstdint>
+#include <memory>
 #include <ostream>
 #include <unix++/File.hpp>
 #include <vector>
+#include "Sink.hpp"
 
 /** Vector of bytes **/
 using ByteArray=std::vector<uint8_t>;
 
+struct z_stream_s;
+
+/** Incremental zlib decompressor which writes its output to a sink **/
+class Inflater : public Decoder {
+public:
+    /** `windowBits` as in inflateInit2(): 15 for zlib, 31 for gzip, -15 for raw deflate **/
+    explicit Inflater(Sink &output, int windowBits=15);
+    ~Inflater();
+    /** Feed the next piece of compressed data, returns true at the end of the stream **/
+    bool update(const void * data, size_t length) override;
+    /** Throws if the end of the compressed stream was not reached **/
+    void finish() override;
+    /** Whether the end of the compressed stream was reached **/
+    bool finished() const { return done; }
+    /** Number of bytes written to the sink **/
+    uint64_t getTotalOut() const;
+    
+private:
+    Inflater(const Inflater &other)=delete;
+    Inflater &operator =(const Inflater &other)=delete;
+    
+    Sink &output;
+    z_stream_s * stream;
+    std::vector<uint8_t> buffer;
+    bool done;
+};
+
 /** Uncompress zlib-compressed data blob **/
 ByteArray uncompress(const ByteArray &in, size_t uncompressedLengthHint=0);
+/** Uncompress zlib-compressed data blob to a sink in a single pass **/
+void uncompress(const void * in, size_t length, Sink &output);
 
 /** Indicates that an attempt to read beyound of file or a block occurred **/
 class EOFException {};
 
+/** Counters of the read-ahead cache **/
+struct CacheStatistics {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t bypasses;
+};
+
+/** Random-access input shared by a BinaryReader and all of its windows **/
+class Source {
+public:
+    virtual ~Source() {}
+    /** Total size of the input in bytes **/
+    virtual size_t getSize() const=0;
+    /** Read up to `length` bytes at `offset`, return the number of bytes read **/
+    virtual size_t read(void * buffer, size_t length, off_t offset)=0;
+    /** Return the whole input if it is mapped into memory, nullptr otherwise **/
+    virtual const uint8_t * map() const { return nullptr; }
+    /** Return a file descriptor which can be used for kernel-side copying, or -1 **/
+    virtual int getDescriptor() const { return -1; }
+    /** Return counters of the read-ahead cache, if there is one **/
+    virtual CacheStatistics getCacheStatistics() const { return CacheStatistics {0, 0, 0}; }
+};
+
+/** Read-only view of bytes which are either mapped or owned by the view **/
+class Span {
+public:
+    /** View of `data`, which `owner` (e.g. the mapped Source) keeps alive if it is given **/
+    Span(const uint8_t * data, size_t length, std::shared_ptr<const void> owner=nullptr) :
+        storage(std::move(owner)), pointer(data), length(length) {}
+    explicit Span(ByteArray &&bytes);
+    /** Part of another span, sharing its storage **/
+    Span(const Span &other, size_t offset, size_t length) :
+        storage(other.storage), pointer(other.pointer+offset), length(length) {}
+    const uint8_t * data() const { return pointer; }
+    size_t size() const { return length; }
+    bool empty() const { return length==0; }
+    const uint8_t * begin() const { return pointer; }
+    const uint8_t * end() const { return pointer+length; }
+    uint8_t operator [](size_t index) const { return pointer[index]; }
+    
+private:
+    std::shared_ptr<const void> storage;
+    const uint8_t * pointer;
+    size_t length;
+};
+
+/** Input held in memory, such as a decrypted or decompressed payload **/
+class MemorySource : public Source {
+public:
+    explicit MemorySource(ByteArray &&data) : data(std::move(data)) {}
+    size_t getSize() const override { return data.size(); }
+    size_t read(void * buffer, size_t length, off_t offset) override;
+    const uint8_t * map() const override { return data.data(); }
+    
+private:
+    ByteArray data;
+};
+
+class BinaryReader;
+
+/** Input assembled from pieces of other inputs placed at given offsets, like
+    an image spread over the blocks of a firmware file. Gaps read as zeroes **/
+class SegmentedSource : public Source {
+public:
+    SegmentedSource();
+    ~SegmentedSource();
+    /** Place the rest of `piece` at `offset` **/
+    void add(off_t offset, const BinaryReader &piece);
+    size_t getSize() const override { return size; }
+    size_t read(void * buffer, size_t length, off_t offset) override;
+    
+private:
+    /** Pieces which do not overlap, by their offset **/
+    struct Segments;
+    std::unique_ptr<Segments> segments;
+    size_t size;
+};
+
+class Hasher;
+class WriteQueue;
+
 class BinaryReader {
 public:
     enum ToEnd { END };
-    BinaryReader(upp::File &file);
+    /** How the file is accessed: PREAD issues a syscall per read, CACHED reads
+        whole blocks ahead, MMAP falls back to CACHED if the file cannot be mapped **/
+    enum Backend { PREAD, CACHED, MMAP };
+    static const size_t DEFAULT_BLOCK_SIZE=256*1024;
+    BinaryReader(upp::File &file, Backend backend=MMAP, size_t blockSize=DEFAULT_BLOCK_SIZE);
+    /** Read from an input which is not a file, e.g. a MemorySource **/
+    explicit BinaryReader(std::shared_ptr<Source> source);
     BinaryReader(const BinaryReader &other);
     BinaryReader(const BinaryReader &other, size_t length);
     BinaryReader(const BinaryReader &other, off_t start, size_t length);
     BinaryReader(const BinaryReader &other, off_t start, ToEnd marker);
     virtual ~BinaryReader();
     size_t getSize() const { return size; }
+    CacheStatistics getCacheStatistics() const { return source->getCacheStatistics(); }
+    const Source * getSource() const { return source.get(); }
     off_t debug() const;
     off_t tell() const;
     size_t available() const;
@@ -48,8 +168,29 @@ public:
     std::string readShortUnicodeString();
     std::string readUnicodeString(size_t length);
     std::wstring readWideString(size_t length);
-    void extract(const std::string &destination, off_t offset, size_t length, bool truncate=false);
-    void extract(const std::string &destination, bool truncate=false);
+    /** Read a record described by a Layout (see Record.hpp) with a single
+        bounds check and a single read **/
+    template <class L>
+    typename L::Type readRecord() {
+        uint8_t buffer[L::SIZE];
+        if (available()<L::SIZE)
+            throw EOFException();
+        read(buffer, L::SIZE);
+        return L::decode(buffer);
+    }
+    /** Get `length` bytes at `offset` without copying them if possible **/
+    Span span(off_t offset, size_t length) const;
+    /** Extract the next `length` bytes to `destination` at `offset`; `hasher`
+        (if given) gets them as they are written **/
+    void extract(const std::string &destination, off_t offset, size_t length, bool truncate=false,
+        Hasher * hasher=nullptr);
+    void extract(const std::string &destination, bool truncate=false, Hasher * hasher=nullptr);
+    /** Extract the rest of the block to a new file through a queue of asynchronous writes **/
+    void extract(const std::string &destination, WriteQueue &queue);
+    /** Write the rest of the block to a sink in chunks of bounded size **/
+    void extract(Sink &sink, Hasher * hasher=nullptr);
+    /** Write the next `length` bytes at `offset` of the file of `sink` **/
+    void extract(BlockSink &sink, off_t offset, size_t length);
     ByteArray read(size_t maxLength);
     ByteArray readAll();
     
@@ -63,12 +204,30 @@ protected:
     }
     
 private:
-    upp::File &file;
+    std::shared_ptr<Source> source;
+    const uint8_t * mapping;
     const off_t start;
     off_t offset;
     size_t size;
 };
 
+/** Stream for the messages of the extraction job running in this thread:
+    standard output unless redirected with ConsoleRedirect **/
+std::ostream &console();
+
+/** Redirects console() of the current thread while it exists **/
+class ConsoleRedirect {
+public:
+    explicit ConsoleRedirect(std::ostream &stream);
+    ~ConsoleRedirect();
+    
+private:
+    ConsoleRedirect(const ConsoleRedirect &other)=delete;
+    ConsoleRedirect &operator =(const ConsoleRedirect &other)=delete;
+    
+    std::ostream * previous;
+};
+
 class Indent {
 public:
     Indent() : offset(0) {}
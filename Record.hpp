@@ -0,0 +1,126 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ *  
+ *  Compile-time descriptions of fixed binary records. A layout lists the
+ *  fields of a record in the order they are stored; the whole record is
+ *  decoded from a single read:
+ *  
+ *      struct Header { uint32_t size; uint16_t version; std::string name; };
+ *      using HeaderLayout=Layout<Header, Magic<'H', 'D', 'R', '0'>,
+ *          LE<&Header::size>, Skip<2>, BE<&Header::version>,
+ *          String<&Header::name, 12>>;
+ *      Header header=is.readRecord<HeaderLayout>();
+ ******************************************************************************/
+
+#ifndef __RECORD_HPP
+#define __RECORD_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+enum class Endian { LITTLE, BIG };
+
+/** Class and type of a pointer to a data member **/
+template <class M>
+struct MemberTraits;
+
+template <class C, class T>
+struct MemberTraits<T C::*> {
+    using Class=C;
+    using Type=T;
+};
+
+/** Load an integer stored with the given byte order **/
+template <class T, Endian E>
+inline T loadInteger(const uint8_t * data) {
+    static_assert(std::is_integral<T>::value, "only integers can be loaded");
+    T value;
+    memcpy(&value, data, sizeof(T));
+#if __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+    constexpr bool swap=E==Endian::BIG;
+#else
+    constexpr bool swap=E==Endian::LITTLE;
+#endif
+    if constexpr (swap&&(sizeof(T)==2))
+        value=T(__builtin_bswap16(value));
+    else if constexpr (swap&&(sizeof(T)==4))
+        value=T(__builtin_bswap32(value));
+    else if constexpr (swap&&(sizeof(T)==8))
+        value=T(__builtin_bswap64(value));
+    return value;
+}
+
+/** Integer field (or an array of integers) with the given byte order **/
+template <auto Member, Endian E>
+struct Field {
+    using Class=typename MemberTraits<decltype(Member)>::Class;
+    using Type=typename MemberTraits<decltype(Member)>::Type;
+    using Element=std::remove_extent_t<Type>;
+    static constexpr size_t COUNT=std::is_array<Type>::value?std::extent<Type>::value:1;
+    static constexpr size_t SIZE=sizeof(Element)*COUNT;
+    
+    static void decode(Class &record, const uint8_t * data) {
+        if constexpr (std::is_array<Type>::value) {
+            for (size_t i=0; i<COUNT; i++)
+                (record.*Member)[i]=loadInteger<Element, E>(data+i*sizeof(Element));
+        }
+        else
+            record.*Member=loadInteger<Type, E>(data);
+    }
+};
+
+template <auto Member>
+using LE=Field<Member, Endian::LITTLE>;
+template <auto Member>
+using BE=Field<Member, Endian::BIG>;
+
+/** Fixed-length string field **/
+template <auto Member, size_t N>
+struct String {
+    using Class=typename MemberTraits<decltype(Member)>::Class;
+    static constexpr size_t SIZE=N;
+    
+    static void decode(Class &record, const uint8_t * data) {
+        (record.*Member).assign(reinterpret_cast<const char *>(data), N);
+    }
+};
+
+/** Bytes which are not decoded **/
+template <size_t N>
+struct Skip {
+    static constexpr size_t SIZE=N;
+    
+    template <class C>
+    static void decode(C &record, const uint8_t * data) {}
+};
+
+/** Fixed string which must be present in the record **/
+template <char... C>
+struct Magic {
+    static constexpr size_t SIZE=sizeof...(C);
+    
+    template <class R>
+    static void decode(R &record, const uint8_t * data) {
+        static const char EXPECTED[]={C...};
+        if (memcmp(data, EXPECTED, SIZE)!=0)
+            throw std::string("wrong magic (expected '")+std::string(EXPECTED, SIZE)+"')";
+    }
+};
+
+/** Layout of a record of type T **/
+template <class T, class... Fields>
+struct Layout {
+    using Type=T;
+    static constexpr size_t SIZE=(Fields::SIZE+...);
+    
+    static T decode(const uint8_t * data) {
+        T record {};
+        size_t offset=0;
+        ((Fields::decode(record, data+offset), offset+=Fields::SIZE), ...);
+        return record;
+    }
+};
+
+#endif
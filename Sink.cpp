@@ -0,0 +1,173 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#include <cinttypes>
+#include <cstdio>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "Sink.hpp"
+
+static SparseMode sparseMode=SPARSE_NONE;
+
+void setSparseMode(SparseMode mode) {
+    sparseMode=mode;
+}
+
+SparseMode getSparseMode() {
+    return sparseMode;
+}
+
+void resetErasedRuns(const std::string &path) {
+    if (sparseMode==SPARSE_ERASED)
+        unlink((path+".erased").c_str());
+}
+
+bool isFilled(const void * data, size_t length, uint8_t value) {
+    const uint8_t * bytes=static_cast<const uint8_t *>(data);
+    size_t i=0;
+    
+#ifdef __SSE2__
+    // XOR with the pattern and OR everything together, 64 bytes per iteration
+    const __m128i pattern=_mm_set1_epi8(value);
+    for (; i+64<=length; i+=64) {
+        const __m128i * p=reinterpret_cast<const __m128i *>(bytes+i);
+        __m128i a=_mm_xor_si128(_mm_loadu_si128(p+0), pattern);
+        __m128i b=_mm_xor_si128(_mm_loadu_si128(p+1), pattern);
+        __m128i c=_mm_xor_si128(_mm_loadu_si128(p+2), pattern);
+        __m128i d=_mm_xor_si128(_mm_loadu_si128(p+3), pattern);
+        __m128i all=_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(all, _mm_setzero_si128()))!=0xFFFF)
+            return false;
+    }
+#else
+    const uint64_t pattern=0x0101010101010101ULL*value;
+    for (; i+8<=length; i+=8) {
+        uint64_t word;
+        memcpy(&word, bytes+i, sizeof(word));
+        if (word!=pattern)
+            return false;
+    }
+#endif
+    
+    for (; i<length; i++)
+        if (bytes[i]!=value)
+            return false;
+    return true;
+}
+
+/******************************************************************************/
+
+void BufferSink::write(const void * data, size_t length) {
+    const uint8_t * bytes=static_cast<const uint8_t *>(data);
+    buffer.insert(buffer.end(), bytes, bytes+length);
+}
+
+/******************************************************************************/
+
+void FileSink::write(const void * data, size_t length) {
+    if (length)
+        file.write(data, length);
+}
+
+/******************************************************************************/
+
+void StreamSink::write(const void * data, size_t length) {
+    if (!stream.write(static_cast<const char *>(data), length))
+        throw "cannot write to the output stream";
+}
+
+/******************************************************************************/
+
+SparseSink::SparseSink(upp::File &file, off_t offset, bool erased) :
+        file(file), position(offset), fileSize(file.seek(0, SEEK_END)), erased(erased),
+        pending(nullptr), pendingLength(0), pendingOffset(offset) {}
+
+void SparseSink::write(const void * data, size_t length) {
+    const uint8_t * bytes=static_cast<const uint8_t *>(data);
+    
+    while (length) {
+        // Only whole blocks aligned in the output file become holes
+        size_t chunk=std::min<size_t>(length, HOLE_SIZE-position%HOLE_SIZE);
+        bool zeroes=false, erasedBlock=false;
+        if (chunk==HOLE_SIZE) {
+            zeroes=isFilled(bytes, chunk, 0x00);
+            erasedBlock=!zeroes&&erased&&isFilled(bytes, chunk, 0xFF);
+        }
+        
+        if (zeroes||erasedBlock) {
+            flush();
+            hole(position, chunk);
+            if (erasedBlock) {
+                if (!erasedRuns.empty()&&(erasedRuns.back().first+off_t(erasedRuns.back().second)==position))
+                    erasedRuns.back().second+=chunk;
+                else
+                    erasedRuns.emplace_back(position, chunk);
+            }
+        }
+        else {
+            if (!pendingLength) {
+                pending=bytes;
+                pendingOffset=position;
+            }
+            pendingLength+=chunk;
+        }
+        
+        bytes+=chunk;
+        position+=chunk;
+        length-=chunk;
+    }
+    
+    // The caller may reuse its buffer
+    flush();
+}
+
+void SparseSink::finish() {
+    flush();
+    if (position>fileSize) {
+        if (ftruncate(file.get(), position)<0)
+            throw "cannot extend a sparse file";
+        fileSize=position;
+    }
+}
+
+void SparseSink::saveErasedRuns(const std::string &path) const {
+    if (erasedRuns.empty())
+        return;
+    
+    upp::File map(path.c_str(), O_WRONLY|O_CREAT|O_APPEND);
+    for (auto i=erasedRuns.begin(); i!=erasedRuns.end(); ++i) {
+        char line[64];
+        int length=snprintf(line, sizeof(line), "0x%" PRIx64 " 0x%zx\n", uint64_t(i->first), i->second);
+        map.write(line, length);
+    }
+}
+
+void SparseSink::flush() {
+    if (pendingLength) {
+        file.seek(pendingOffset);
+        file.write(pending, pendingLength);
+        if (pendingOffset+off_t(pendingLength)>fileSize)
+            fileSize=pendingOffset+pendingLength;
+        pendingLength=0;
+    }
+}
+
+void SparseSink::hole(off_t offset, size_t length) {
+    // Holes beyond the end of the file appear by themselves; existing data
+    // has to be deallocated
+    if (offset<fileSize) {
+        size_t existing=std::min<size_t>(length, fileSize-offset);
+        if (fallocate(file.get(), FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, offset, existing)<0) {
+            static const uint8_t ZEROES[HOLE_SIZE]={};
+            file.seek(offset);
+            for (size_t done=0; done<existing; done+=HOLE_SIZE)
+                file.write(ZEROES, std::min(HOLE_SIZE, existing-done));
+        }
+    }
+}
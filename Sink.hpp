@@ -0,0 +1,127 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#ifndef __SINK_HPP
+#define __SINK_HPP
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unix++/File.hpp>
+#include <utility>
+#include <vector>
+
+/** How runs of padding are written to extracted files **/
+enum SparseMode {
+    /** Write everything **/
+    SPARSE_NONE,
+    /** Leave holes instead of blocks of zeroes **/
+    SPARSE_ZEROES,
+    /** Also leave holes instead of blocks of erased flash (0xFF) and record
+        them in a sidecar map **/
+    SPARSE_ERASED
+};
+
+/** Set the sparse mode for all extracted files **/
+void setSparseMode(SparseMode mode);
+/** Get the sparse mode for extracted files **/
+SparseMode getSparseMode();
+/** Start the map of the erased runs of the file at `path` afresh, before
+    the first piece of the file is written **/
+void resetErasedRuns(const std::string &path);
+
+/** Destination of a stream of bytes **/
+class Sink {
+public:
+    virtual ~Sink() {}
+    /** Append `length` bytes to the stream **/
+    virtual void write(const void * data, size_t length)=0;
+};
+
+/** Destination of a file written in pieces at any offsets, like an image
+    made of the blocks of a firmware. Gaps read as zeroes **/
+class BlockSink {
+public:
+    virtual ~BlockSink() {}
+    /** Write `length` bytes at `offset` of the file **/
+    virtual void write(const void * data, size_t length, uint64_t offset)=0;
+};
+
+/** Streaming decompressor which writes its output to a sink **/
+class Decoder {
+public:
+    virtual ~Decoder() {}
+    /** Feed the next piece of encoded data, returns true at the end of the stream **/
+    virtual bool update(const void * data, size_t length)=0;
+    /** Flush the output after the last piece, throws if the stream is incomplete **/
+    virtual void finish()=0;
+};
+
+/** Appends the stream to a byte array **/
+class BufferSink : public Sink {
+public:
+    explicit BufferSink(std::vector<uint8_t> &buffer) : buffer(buffer) {}
+    void write(const void * data, size_t length) override;
+    
+private:
+    std::vector<uint8_t> &buffer;
+};
+
+/** Writes the stream to a file at its current position **/
+class FileSink : public Sink {
+public:
+    explicit FileSink(upp::File &file) : file(file) {}
+    void write(const void * data, size_t length) override;
+    
+private:
+    upp::File &file;
+};
+
+/** Writes the stream to an output stream, such as the standard output **/
+class StreamSink : public Sink {
+public:
+    explicit StreamSink(std::ostream &stream) : stream(stream) {}
+    void write(const void * data, size_t length) override;
+    
+private:
+    std::ostream &stream;
+};
+
+/** Writes the stream to a file starting at `offset`, leaving holes instead
+    of blocks of padding **/
+class SparseSink : public Sink {
+public:
+    using Runs=std::vector<std::pair<off_t, size_t>>;
+    /** Granularity of holes **/
+    static constexpr size_t HOLE_SIZE=4096;
+    
+    SparseSink(upp::File &file, off_t offset, bool erased);
+    void write(const void * data, size_t length) override;
+    /** Extend the file to the end of the stream if it ends with a hole **/
+    void finish();
+    /** Runs of erased bytes which were not written **/
+    const Runs &getErasedRuns() const { return erasedRuns; }
+    /** Append the runs of erased bytes to a sidecar map of the file, so that
+        the pieces of a file written since resetErasedRuns() add up **/
+    void saveErasedRuns(const std::string &path) const;
+    
+private:
+    void flush();
+    void hole(off_t offset, size_t length);
+    
+    upp::File &file;
+    off_t position;
+    off_t fileSize;
+    bool erased;
+    /** Data which is not written yet **/
+    const uint8_t * pending;
+    size_t pendingLength;
+    off_t pendingOffset;
+    Runs erasedRuns;
+};
+
+/** Check whether all bytes in the buffer are equal to `value` **/
+bool isFilled(const void * data, size_t length, uint8_t value);
+
+#endif
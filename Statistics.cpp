@@ -0,0 +1,159 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#include <cstdio>
+#include "Events.hpp"
+#include "Progress.hpp"
+#include "Sink.hpp"
+#include "Statistics.hpp"
+
+using std::string;
+
+/******************************************************************************/
+
+static const char * const COUNTER_NAMES[]={"preads", "bytes_read", "extracts", "files", "bytes_written"};
+static const char * const PHASE_NAMES[]={"detect", "parse", "decode", "decrypt", "write"};
+
+/** Statistics of the job running in this thread, if they are collected **/
+static thread_local Statistics * current=nullptr;
+
+/** Counts the bytes written to a sink and the time it takes **/
+class MeteredSink : public Sink {
+public:
+    explicit MeteredSink(std::unique_ptr<Sink> sink) : sink(std::move(sink)) {}
+    void write(const void * data, size_t length) override {
+        PhaseTimer timer(Statistics::WRITE);
+        count(Statistics::BYTES_WRITTEN, length);
+        progressWritten(length);
+        sink->write(data, length);
+    }
+    
+private:
+    std::unique_ptr<Sink> sink;
+};
+
+/******************************************************************************/
+
+Statistics::Statistics() : phase(PARSE), since(std::chrono::steady_clock::now()) {
+    handler=&handlers["-"];
+}
+
+void Statistics::add(const Statistics &other) {
+    for (auto i=other.handlers.begin(); i!=other.handlers.end(); ++i) {
+        Handler &total=handlers[i->first];
+        total.calls+=i->second.calls;
+        for (unsigned j=0; j<COUNTERS; j++)
+            total.counters[j]+=i->second.counters[j];
+        for (unsigned j=0; j<PHASES; j++)
+            total.nanoseconds[j]+=i->second.nanoseconds[j];
+    }
+}
+
+void Statistics::print(std::ostream &stream) const {
+    char line[256];
+    snprintf(line, sizeof(line), "%-12s %6s %8s %9s %8s %7s %10s %9s %9s %9s %9s %9s\n", "Handler", "Calls",
+        "Preads", "MB read", "Extracts", "Files", "MB written", "Detect s", "Parse s", "Decode s",
+        "Decrypt s", "Write s");
+    stream << line;
+    
+    Handler total {};
+    auto printHandler=[&stream, &line](const string &name, const Handler &handler) {
+        const uint64_t * c=handler.counters;
+        const uint64_t * t=handler.nanoseconds;
+        snprintf(line, sizeof(line), "%-12s %6llu %8llu %9.1f %8llu %7llu %10.1f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+            name.c_str(), (unsigned long long) handler.calls, (unsigned long long) c[PREADS], c[BYTES_READ]/1e6,
+            (unsigned long long) c[EXTRACTS], (unsigned long long) c[FILES], c[BYTES_WRITTEN]/1e6,
+            t[DETECT]/1e9, t[PARSE]/1e9, t[DECODE]/1e9, t[DECRYPT]/1e9, t[WRITE]/1e9);
+        stream << line;
+    };
+    for (auto i=handlers.begin(); i!=handlers.end(); ++i) {
+        printHandler(i->first, i->second);
+        total.calls+=i->second.calls;
+        for (unsigned j=0; j<COUNTERS; j++)
+            total.counters[j]+=i->second.counters[j];
+        for (unsigned j=0; j<PHASES; j++)
+            total.nanoseconds[j]+=i->second.nanoseconds[j];
+    }
+    if (handlers.size()>1)
+        printHandler("total", total);
+}
+
+string Statistics::toJSON() const {
+    string result="{";
+    for (auto i=handlers.begin(); i!=handlers.end(); ++i) {
+        if (i!=handlers.begin())
+            result+=',';
+        appendJSONString(result, i->first);
+        result+=":{\"calls\":"+std::to_string(i->second.calls);
+        for (unsigned j=0; j<COUNTERS; j++)
+            result+=string(",\"")+COUNTER_NAMES[j]+"\":"+std::to_string(i->second.counters[j]);
+        result+=",\"seconds\":{";
+        for (unsigned j=0; j<PHASES; j++) {
+            char seconds[32];
+            snprintf(seconds, sizeof(seconds), "%.6f", i->second.nanoseconds[j]/1e9);
+            result+=string(j?",\"":"\"")+PHASE_NAMES[j]+"\":"+seconds;
+        }
+        result+="}}";
+    }
+    return result+'}';
+}
+
+void Statistics::switchTo(Handler * handler, Phase phase) {
+    auto now=std::chrono::steady_clock::now();
+    this->handler->nanoseconds[this->phase]+=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now-since).count();
+    since=now;
+    this->handler=handler;
+    this->phase=phase;
+}
+
+/******************************************************************************/
+
+StatisticsScope::StatisticsScope(Statistics &statistics) : previous(current) {
+    current=&statistics;
+    statistics.switchTo(statistics.handler, statistics.phase);
+}
+
+StatisticsScope::~StatisticsScope() {
+    current->switchTo(current->handler, current->phase);
+    current=previous;
+}
+
+PhaseTimer::PhaseTimer(Statistics::Phase phase) : previous(Statistics::PARSE) {
+    if (current) {
+        previous=current->phase;
+        current->switchTo(current->handler, phase);
+    }
+}
+
+PhaseTimer::~PhaseTimer() {
+    if (current)
+        current->switchTo(current->handler, previous);
+}
+
+HandlerTimer::HandlerTimer(const string &name) : previous(nullptr), previousPhase(Statistics::PARSE) {
+    if (current) {
+        Statistics::Handler &handler=current->handlers[name];
+        handler.calls++;
+        previous=current->handler;
+        previousPhase=current->phase;
+        current->switchTo(&handler, Statistics::PARSE);
+    }
+}
+
+HandlerTimer::~HandlerTimer() {
+    if (current&&previous)
+        current->switchTo(previous, previousPhase);
+}
+
+void count(Statistics::Counter counter, uint64_t amount) {
+    if (current)
+        current->handler->counters[counter]+=amount;
+}
+
+std::unique_ptr<Sink> meter(std::unique_ptr<Sink> sink) {
+    if ((!current&&!isProgressReported())||!sink)
+        return sink;
+    return std::unique_ptr<Sink>(new MeteredSink(std::move(sink)));
+}
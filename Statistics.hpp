@@ -0,0 +1,114 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#ifndef __STATISTICS_HPP
+#define __STATISTICS_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+
+class Sink;
+
+/** Counters and times of an unpacking job, kept for every handler. They are
+    collected only in the threads which have a StatisticsScope, elsewhere
+    counting costs a check of a thread-local pointer **/
+class Statistics {
+public:
+    enum Counter {
+        /** pread() calls on the input and the bytes they returned **/
+        PREADS, BYTES_READ,
+        /** BinaryReader::extract() calls **/
+        EXTRACTS,
+        /** Files started through a Context **/
+        FILES,
+        /** Bytes extracted or written to the sinks of the files **/
+        BYTES_WRITTEN,
+        COUNTERS
+    };
+    /** What the time is spent on; nested phases are not counted in the outer ones **/
+    enum Phase { DETECT, PARSE, DECODE, DECRYPT, WRITE, PHASES };
+    
+    struct Handler {
+        uint64_t calls;
+        uint64_t counters[COUNTERS];
+        uint64_t nanoseconds[PHASES];
+    };
+    
+    Statistics();
+    Statistics(const Statistics &other)=delete;
+    Statistics &operator =(const Statistics &other)=delete;
+    /** Add the statistics of another job, handler by handler **/
+    void add(const Statistics &other);
+    /** Print a table of the handlers, with the totals if there are several **/
+    void print(std::ostream &stream) const;
+    /** Statistics as a JSON object **/
+    std::string toJSON() const;
+    
+private:
+    friend class StatisticsScope;
+    friend class PhaseTimer;
+    friend class HandlerTimer;
+    friend void count(Counter counter, uint64_t amount);
+    
+    /** Charge the time since the last switch and continue with `handler` in `phase` **/
+    void switchTo(Handler * handler, Phase phase);
+    
+    /** Handlers by name, the work outside of them is under "-" **/
+    std::map<std::string, Handler> handlers;
+    Handler * handler;
+    Phase phase;
+    std::chrono::steady_clock::time_point since;
+};
+
+/** Collects the statistics of the current thread into `statistics` while it exists **/
+class StatisticsScope {
+public:
+    explicit StatisticsScope(Statistics &statistics);
+    ~StatisticsScope();
+    
+private:
+    StatisticsScope(const StatisticsScope &other)=delete;
+    StatisticsScope &operator =(const StatisticsScope &other)=delete;
+    
+    Statistics * previous;
+};
+
+/** Charges the time until it is destroyed to `phase` **/
+class PhaseTimer {
+public:
+    explicit PhaseTimer(Statistics::Phase phase);
+    ~PhaseTimer();
+    
+private:
+    PhaseTimer(const PhaseTimer &other)=delete;
+    PhaseTimer &operator =(const PhaseTimer &other)=delete;
+    
+    Statistics::Phase previous;
+};
+
+/** Charges the work until it is destroyed to the handler `name` **/
+class HandlerTimer {
+public:
+    explicit HandlerTimer(const std::string &name);
+    ~HandlerTimer();
+    
+private:
+    HandlerTimer(const HandlerTimer &other)=delete;
+    HandlerTimer &operator =(const HandlerTimer &other)=delete;
+    
+    Statistics::Handler * previous;
+    Statistics::Phase previousPhase;
+};
+
+/** Add `amount` to the counter of the current handler **/
+void count(Statistics::Counter counter, uint64_t amount=1);
+/** `sink` counting the bytes written and their time, if statistics are collected
+    or progress is reported **/
+std::unique_ptr<Sink> meter(std::unique_ptr<Sink> sink);
+
+#endif
@@ -0,0 +1,211 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <fstream>
+#include <linux/fs.h>
+#include <openssl/evp.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Sink.hpp"
+#include "Store.hpp"
+
+using std::string;
+
+/******************************************************************************/
+
+/** Create the parent directories of `path`, ignoring errors **/
+static void makeParents(const string &path) {
+    for (size_t slash=path.find('/', 1); slash!=string::npos; slash=path.find('/', slash+1))
+        mkdir(path.substr(0, slash).c_str(), 0755);
+}
+
+/** Make `target` a copy of the object: a reflink, a hard link, or the bytes **/
+static void materialize(int object, const string &objectPath, const string &target) {
+    unlink(target.c_str());
+    int out=open(target.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if (out<0)
+        throw "cannot create "+target;
+    if (ioctl(out, FICLONE, object)==0) {
+        close(out);
+        return;
+    }
+    close(out);
+    unlink(target.c_str());
+    if (link(objectPath.c_str(), target.c_str())==0)
+        return;
+    
+    // Another file system, copy inside the kernel
+    out=open(target.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if (out<0)
+        throw "cannot create "+target;
+    struct stat st;
+    off_t offset=0;
+    if (fstat(object, &st)==0)
+        while ((offset<st.st_size)&&(sendfile(out, object, &offset, st.st_size-offset)>0));
+    close(out);
+    if (offset<st.st_size)
+        throw "cannot copy "+objectPath+" to "+target;
+}
+
+/** Writes a file to a temporary file of the store while hashing it. Pieces
+    written at offsets are hashed as they come while each one starts at or
+    after the end of the previous ones, gaps as zeroes; otherwise the file is
+    read back and hashed once it is complete **/
+class StoreSink : public Sink, public BlockSink {
+public:
+    StoreSink(Store &store, const string &path) : store(store), path(path), size(0), ordered(true),
+            context(EVP_MD_CTX_new()) {
+        temporary=store.directory+"/tmp/XXXXXX";
+        fd=mkostemp(&temporary[0], O_CLOEXEC);
+        if (fd<0)
+            throw "cannot create a file in "+store.directory+"/tmp";
+        if (!context||(EVP_DigestInit_ex(context, EVP_sha256(), nullptr)!=1)) {
+            close(fd);
+            unlink(temporary.c_str());
+            EVP_MD_CTX_free(context);
+            throw "EVP_DigestInit_ex()";
+        }
+    }
+    ~StoreSink() {
+        // The file is incomplete if unpacking failed
+        bool complete=!std::uncaught_exceptions()&&(ordered||rehash());
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned length=0;
+        EVP_DigestFinal_ex(context, digest, &length);
+        EVP_MD_CTX_free(context);
+        if (!complete) {
+            close(fd);
+            unlink(temporary.c_str());
+            if (!std::uncaught_exceptions())
+                store.fail("cannot read "+temporary);
+            return;
+        }
+        
+        store.add(fd, temporary, toHex(digest, length), size, path);
+    }
+    void write(const void * data, size_t length) override {
+        write(data, length, size);
+    }
+    void write(const void * data, size_t length, uint64_t offset) override {
+        static const uint8_t ZEROES[4096]={};
+        if (offset<size)
+            ordered=false;
+        if (ordered) {
+            for (uint64_t gap=offset-size; gap;) {
+                size_t chunk=std::min<uint64_t>(gap, sizeof(ZEROES));
+                EVP_DigestUpdate(context, ZEROES, chunk);
+                gap-=chunk;
+            }
+            EVP_DigestUpdate(context, data, length);
+        }
+        const char * bytes=static_cast<const char *>(data);
+        for (size_t done=0; done<length;) {
+            ssize_t written=pwrite(fd, bytes+done, length-done, offset+done);
+            if (written<=0)
+                throw "cannot write to "+temporary;
+            done+=written;
+        }
+        size=std::max<uint64_t>(size, offset+length);
+    }
+    
+private:
+    /** Hash the whole file again, returns false if it cannot be read **/
+    bool rehash() {
+        std::vector<char> buffer(1<<20);
+        EVP_DigestInit_ex(context, EVP_sha256(), nullptr);
+        for (uint64_t done=0; done<size;) {
+            ssize_t got=pread(fd, &buffer[0], std::min<uint64_t>(size-done, buffer.size()), done);
+            if (got<=0)
+                return false;
+            EVP_DigestUpdate(context, &buffer[0], got);
+            done+=got;
+        }
+        return true;
+    }
+    
+    Store &store;
+    string path;
+    string temporary;
+    int fd;
+    uint64_t size;
+    /** Whether the pieces came in order, so that the hash is up to date **/
+    bool ordered;
+    EVP_MD_CTX * context;
+};
+
+/******************************************************************************/
+
+Store::Store(const string &directory) : directory(directory), newObjects(0), sharedBytes(0) {
+    makeParents(directory+"/objects/");
+    makeParents(directory+"/tmp/");
+}
+
+std::unique_ptr<Sink> Store::create(const string &path) {
+    makeParents(path);
+    return std::unique_ptr<Sink>(new StoreSink(*this, path));
+}
+
+std::unique_ptr<BlockSink> Store::createBlocks(const string &path) {
+    makeParents(path);
+    return std::unique_ptr<BlockSink>(new StoreSink(*this, path));
+}
+
+void Store::add(int fd, const string &temporary, const string &hash, uint64_t size, const string &path) {
+    // Objects are read-only, as they may be hard links of the output files
+    string object=directory+"/objects/"+hash.substr(0, 2)+'/'+hash.substr(2);
+    makeParents(object);
+    fchmod(fd, 0444);
+    bool created=link(temporary.c_str(), object.c_str())==0;
+    int objectFd=created?fd:open(object.c_str(), O_RDONLY|O_CLOEXEC);
+    unlink(temporary.c_str());
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    try {
+        if (objectFd<0)
+            throw "cannot store "+path;
+        materialize(objectFd, object, path);
+    }
+    catch (const string &message) {
+        if (error.empty())
+            error=message;
+    }
+    if (objectFd!=fd)
+        close(objectFd);
+    close(fd);
+    
+    files.push_back(File {hash, path});
+    if (created)
+        newObjects++;
+    else
+        sharedBytes+=size;
+}
+
+void Store::fail(const string &message) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (error.empty())
+        error=message;
+}
+
+void Store::writeManifest(const string &path, const string &outputDir) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!error.empty())
+        throw error;
+    
+    std::ofstream manifest(path, std::ios::trunc);
+    for (auto i=files.begin(); i!=files.end(); ++i) {
+        string relative=i->path.compare(0, outputDir.size()+1, outputDir+'/')==0?
+            i->path.substr(outputDir.size()+1):i->path;
+        manifest << i->hash << "  " << relative << '\n';
+    }
+    if (!manifest.flush())
+        throw "cannot write "+path;
+}
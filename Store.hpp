@@ -0,0 +1,59 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#ifndef __STORE_HPP
+#define __STORE_HPP
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Context.hpp"
+
+/** Content-addressed store of unpacked files. Every file is hashed while it
+    is written, kept once as `objects/XX/HASH` in the store directory, and
+    appears in the output tree as a reflink (or a hard link, or a copy if
+    neither is possible) of the object **/
+class Store : public Output {
+public:
+    /** Use the store in `directory`, creating it if needed **/
+    explicit Store(const std::string &directory);
+    std::unique_ptr<Sink> create(const std::string &path) override;
+    /** The pieces are written to the temporary file of the object **/
+    std::unique_ptr<BlockSink> createBlocks(const std::string &path) override;
+    /** Write the SHA-256 and the path relative to `outputDir` of every file
+        to `path`, in the format of sha256sum. Throws if a file could not be
+        stored **/
+    void writeManifest(const std::string &path, const std::string &outputDir);
+    /** Number of files and of the objects which were new **/
+    unsigned getFiles() const { return files.size(); }
+    unsigned getNewObjects() const { return newObjects; }
+    /** Bytes which were not stored again because the object existed **/
+    uint64_t getSharedBytes() const { return sharedBytes; }
+    
+private:
+    friend class StoreSink;
+    
+    struct File {
+        std::string hash;
+        std::string path;
+    };
+    
+    /** Move the data in the temporary file to its object and link `path` to it **/
+    void add(int fd, const std::string &temporary, const std::string &hash, uint64_t size,
+        const std::string &path);
+    /** Remember the first error **/
+    void fail(const std::string &message);
+    
+    std::string directory;
+    std::mutex mutex;
+    std::vector<File> files;
+    unsigned newObjects;
+    uint64_t sharedBytes;
+    /** First error, reported by writeManifest() **/
+    std::string error;
+};
+
+#endif
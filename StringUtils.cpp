@@ -1,3 +1,12 @@
+#include <algorithm>
+#include <cstdint>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__)||defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2_DISPATCH
+#endif
 #include "StringUtils.hpp"
 
 using std::string;
@@ -37,26 +46,118 @@ string trim(const string &str) {
 }
 
 string convert(const wstring &in) {
-    string result;
-    for (size_t i=0; i<in.size(); i++) {
-        wchar_t c=in[i];
-        if (c<0x80)
-            result.push_back(c);
-        else if (c<0x800) {
-            result.push_back(0xC0|(c>>6));
-            result.push_back(0x80|(c&63));
-        }
-        else if (c<0x8000) {
-            result.push_back(0xE0|(c>>12));
-            result.push_back(0x80|((c>>6)&63));
-            result.push_back(0x80|(c&63));
+    std::u16string units(in.begin(), in.end());
+    return utf16ToUtf8(units.data(), units.size(), false);
+}
+
+/******************************************************************************/
+
+static inline uint16_t loadUnit(const uint8_t * p, bool bigEndian) {
+    return bigEndian?(p[0]<<8)|p[1]:p[0]|(p[1]<<8);
+}
+
+/** Transcode a single code point (or surrogate pair) starting at units[i].
+    Returns the number of code units consumed **/
+static inline size_t transcodeOne(const uint8_t * units, size_t i, size_t count, bool bigEndian, char *&out) {
+    uint32_t c=loadUnit(units+i*2, bigEndian);
+    size_t consumed=1;
+    
+    if ((c>=0xD800)&&(c<0xE000)) {
+        uint32_t low=(i+1<count)?loadUnit(units+(i+1)*2, bigEndian):0;
+        if ((c<0xDC00)&&(low>=0xDC00)&&(low<0xE000)) {
+            c=0x10000+((c-0xD800)<<10)+(low-0xDC00);
+            consumed=2;
         }
-        else {
-            result.push_back(0xF0|(c>>18));
-            result.push_back(0x80|((c>>12)&63));
-            result.push_back(0x80|((c>>6)&63));
-            result.push_back(0x80|(c&63));
+        else
+            c=0xFFFD;
+    }
+    
+    if (c<0x80)
+        *out++=c;
+    else if (c<0x800) {
+        *out++=0xC0|(c>>6);
+        *out++=0x80|(c&63);
+    }
+    else if (c<0x10000) {
+        *out++=0xE0|(c>>12);
+        *out++=0x80|((c>>6)&63);
+        *out++=0x80|(c&63);
+    }
+    else {
+        *out++=0xF0|(c>>18);
+        *out++=0x80|((c>>12)&63);
+        *out++=0x80|((c>>6)&63);
+        *out++=0x80|(c&63);
+    }
+    return consumed;
+}
+
+#ifdef __SSE2__
+/** Narrow runs of 8 ASCII code units at a time. Returns the new position **/
+static size_t asciiSSE2(const uint8_t * units, size_t i, size_t count, bool bigEndian, char *&out) {
+    const __m128i mask=_mm_set1_epi16(bigEndian?0x80FF:0xFF80);
+    const __m128i zero=_mm_setzero_si128();
+    for (; i+8<=count; i+=8) {
+        __m128i v=_mm_loadu_si128(reinterpret_cast<const __m128i *>(units+i*2));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, mask), zero))!=0xFFFF)
+            break;
+        if (bigEndian)
+            v=_mm_srli_epi16(v, 8);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out), _mm_packus_epi16(v, v));
+        out+=8;
+    }
+    return i;
+}
+#endif
+
+#ifdef HAVE_AVX2_DISPATCH
+/** Same as asciiSSE2(), 16 code units at a time **/
+__attribute__((target("avx2")))
+static size_t asciiAVX2(const uint8_t * units, size_t i, size_t count, bool bigEndian, char *&out) {
+    const __m256i mask=_mm256_set1_epi16(bigEndian?0x80FF:0xFF80);
+    for (; i+16<=count; i+=16) {
+        __m256i v=_mm256_loadu_si256(reinterpret_cast<const __m256i *>(units+i*2));
+        if (!_mm256_testz_si256(v, mask))
+            break;
+        if (bigEndian)
+            v=_mm256_srli_epi16(v, 8);
+        // packus works within 128-bit lanes, so gather both halves into the low lane
+        __m256i packed=_mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0xD8);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm256_castsi256_si128(packed));
+        out+=16;
+    }
+    return i;
+}
+
+static bool hasAVX2() {
+    static const bool result=__builtin_cpu_supports("avx2");
+    return result;
+}
+#endif
+
+string utf16ToUtf8(const void * data, size_t count, bool bigEndian) {
+    const uint8_t * units=static_cast<const uint8_t *>(data);
+    // Each code unit produces at most 3 bytes (a surrogate pair produces 4)
+    string result(count*3, '\0');
+    char * out=&result[0];
+    
+    for (size_t i=0; i<count;) {
+#ifdef HAVE_AVX2_DISPATCH
+        if (hasAVX2())
+            i=asciiAVX2(units, i, count, bigEndian, out);
+#endif
+#ifdef __SSE2__
+        i=asciiSSE2(units, i, count, bigEndian, out);
+#endif
+        // Scalar tail and non-ASCII code points; stay scalar while the text is not ASCII
+        for (size_t limit=std::min(count, i+8); i<limit;) {
+            if (loadUnit(units+i*2, bigEndian)<0x80)
+                *out++=units[i++*2+bigEndian];
+            else
+                i+=transcodeOne(units, i, count, bigEndian, out);
         }
     }
+    
+    result.resize(out-result.data());
     return result;
 }
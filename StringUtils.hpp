@@ -1,6 +1,7 @@
 #ifndef __STRINGUTILS_HPP
 #define __STRINGUTILS_HPP
 
+#include <cstddef>
 #include <string>
 
 bool endsWith(std::string const &fullString, std::string const &ending);
@@ -11,5 +12,8 @@ std::string toHexString(const std::string &in);
 std::string trim(const std::string &in);
 /** Convert a string from UTF-16 to UTF-8 **/
 std::string convert(const std::wstring &in);
+/** Convert count UTF-16 code units (little or big endian) to UTF-8.
+    Unpaired surrogates are replaced by U+FFFD **/
+std::string utf16ToUtf8(const void * data, size_t count, bool bigEndian=false);
 
 #endif
@@ -0,0 +1,96 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#include <cstdio>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "Events.hpp"
+#include "Trace.hpp"
+
+using std::string;
+
+/******************************************************************************/
+
+/** Trace which is being recorded, if any **/
+static Trace * active=nullptr;
+
+/** Members of an event common to all events of the current thread **/
+static const string &threadMembers() {
+    thread_local string members=",\"pid\":"+std::to_string(getpid())+
+        ",\"tid\":"+std::to_string(syscall(SYS_gettid));
+    return members;
+}
+
+/******************************************************************************/
+
+Trace::Trace(const string &path) : file(path, std::ios::out|std::ios::trunc),
+        start(std::chrono::steady_clock::now()) {
+    if (!file)
+        throw "cannot open the trace file";
+    active=this;
+}
+
+Trace::~Trace() {
+    if (active==this)
+        active=nullptr;
+}
+
+void Trace::save() {
+    std::lock_guard<std::mutex> lock(mutex);
+    file << "{\"traceEvents\":[\n" << events << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    file.flush();
+    if (!file)
+        throw "cannot write the trace file";
+}
+
+void Trace::add(const string &event) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!events.empty())
+        events+=",\n";
+    events+='{'+event+threadMembers()+'}';
+}
+
+double Trace::since(std::chrono::steady_clock::time_point time) const {
+    return std::chrono::duration<double, std::micro>(time-start).count();
+}
+
+/******************************************************************************/
+
+TraceSpan::TraceSpan(const char * name, const string &detail, off_t offset, uint64_t bytes) :
+        offset(offset), bytes(bytes) {
+    if (active) {
+        this->name=string(name)+' '+detail;
+        start=std::chrono::steady_clock::now();
+    }
+}
+
+TraceSpan::TraceSpan(const char * name, off_t offset, uint64_t bytes) : offset(offset), bytes(bytes) {
+    if (active) {
+        this->name=name;
+        start=std::chrono::steady_clock::now();
+    }
+}
+
+TraceSpan::~TraceSpan() {
+    if (!active||name.empty())
+        return;
+    std::chrono::duration<double, std::micro> duration=std::chrono::steady_clock::now()-start;
+    char times[64];
+    snprintf(times, sizeof(times), ",\"ts\":%.3f,\"dur\":%.3f", active->since(start), duration.count());
+    string event="\"name\":";
+    appendJSONString(event, name);
+    event+=",\"cat\":\"unpacker\",\"ph\":\"X\"";
+    event+=times;
+    if (offset>=0)
+        event+=",\"args\":{\"offset\":"+std::to_string(offset)+",\"bytes\":"+std::to_string(bytes)+'}';
+    active->add(event);
+}
+
+void setThreadName(const string &name) {
+    if (!active)
+        return;
+    string event="\"name\":\"thread_name\",\"ph\":\"M\",\"args\":{\"name\":";
+    appendJSONString(event, name);
+    active->add(event+'}');
+}
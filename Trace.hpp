@@ -0,0 +1,64 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#ifndef __TRACE_HPP
+#define __TRACE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+
+/** Spans of the work of all threads in the Chrome trace-event format, which
+    can be opened in Perfetto or about:tracing. While a Trace exists, every
+    TraceSpan is recorded in it; otherwise a span costs a check of a pointer **/
+class Trace {
+public:
+    /** Start recording, the events are saved to `path` **/
+    explicit Trace(const std::string &path);
+    ~Trace();
+    /** Write the recorded events to the file **/
+    void save();
+    
+private:
+    Trace(const Trace &other)=delete;
+    Trace &operator =(const Trace &other)=delete;
+    friend class TraceSpan;
+    friend void setThreadName(const std::string &name);
+    
+    /** Append an event, given as the members of its JSON object **/
+    void add(const std::string &event);
+    /** Microseconds since the start of recording **/
+    double since(std::chrono::steady_clock::time_point time) const;
+    
+    std::ofstream file;
+    std::chrono::steady_clock::time_point start;
+    std::mutex mutex;
+    std::string events;
+};
+
+/** Work from its construction until it is destroyed, covering `bytes` of the
+    input at `offset` (not recorded if negative) **/
+class TraceSpan {
+public:
+    TraceSpan(const char * name, const std::string &detail, off_t offset=-1, uint64_t bytes=0);
+    explicit TraceSpan(const char * name, off_t offset=-1, uint64_t bytes=0);
+    ~TraceSpan();
+    
+private:
+    TraceSpan(const TraceSpan &other)=delete;
+    TraceSpan &operator =(const TraceSpan &other)=delete;
+    
+    std::string name;
+    off_t offset;
+    uint64_t bytes;
+    std::chrono::steady_clock::time_point start;
+};
+
+/** Name the current thread in the trace **/
+void setThreadName(const std::string &name);
+
+#endif
@@ -1,5 +1,12 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ftw.h>
+#include <mutex>
 #include <set>
 #include "REUtils.hpp"
+#include "Statistics.hpp"
+#include "Trace.hpp"
 #include "TypeRegistration.hpp"
 
 using std::set;
@@ -13,13 +20,73 @@ static set<const TypeRegistration *> &getRegistrations() {
     return list;
 }
 
-TypeRegistration::TypeRegistration(const char * name, DetectFunction detect, ExtractFunction extract) :
-        name(name), detect(detect), extract(extract) {
+/** A signature together with the file type it identifies **/
+struct SignatureEntry {
+    const TypeRegistration::Signature * signature;
+    const TypeRegistration * registration;
+    /** Number of significant bits, more specific signatures are tried first **/
+    unsigned weight;
+};
+
+static vector<SignatureEntry> &getSignatureIndex() {
+    static vector<SignatureEntry> index;
+    return index;
+}
+
+static bool &isSignatureIndexValid() {
+    static bool valid=false;
+    return valid;
+}
+
+static bool matches(const TypeRegistration::Signature &signature, const uint8_t * head, size_t length) {
+    if ((signature.offset>length)||(signature.bytes.size()>length-signature.offset))
+        return false;
+    
+    const uint8_t * data=head+signature.offset;
+    const uint8_t * bytes=reinterpret_cast<const uint8_t *>(signature.bytes.data());
+    const uint8_t * mask=reinterpret_cast<const uint8_t *>(signature.mask.data());
+    if (signature.mask.empty())
+        return memcmp(data, bytes, signature.bytes.size())==0;
+    for (size_t i=0; i<signature.bytes.size(); i++)
+        if ((data[i]^bytes[i])&mask[i])
+            return false;
+    return true;
+}
+
+/** Maximum and current nesting level of recursive unpacking **/
+static unsigned recursionDepth=0;
+static thread_local unsigned recursionLevel=0;
+
+static int removeEntry(const char * path, const struct stat * st, int type, struct FTW * ftw) {
+    remove(path);
+    return 0;
+}
+
+/** Remove a directory with everything in it **/
+static void removeTree(const string &directory) {
+    nftw(directory.c_str(), removeEntry, 16, FTW_DEPTH|FTW_PHYS);
+}
+
+void setRecursionDepth(unsigned depth) {
+    recursionDepth=depth;
+}
+
+unsigned getRecursionDepth() {
+    return recursionDepth;
+}
+
+/******************************************************************************/
+
+TypeRegistration::TypeRegistration(const char * name, DetectFunction detect, ExtractFunction extract,
+        const Signature * signaturesBegin, const Signature * signaturesEnd) :
+        name(name), detect(detect), extract(extract), signatures(signaturesBegin, signaturesEnd) {
     getRegistrations().insert(this);
+    isSignatureIndexValid()=false;
 }
 
 TypeRegistration::~TypeRegistration() {
     getRegistrations().erase(this);
+    isSignatureIndexValid()=false;
 }
 
 vector<const char *> TypeRegistration::list() {
@@ -42,16 +109,99 @@ TypeRegistration::ExtractFunction TypeRegistration::get(const string &name) {
     return nullptr;
 }
 
-TypeRegistration::ExtractFunction TypeRegistration::resolve(BinaryReader &is, const string &filename) {
+const TypeRegistration * TypeRegistration::identify(BinaryReader &is, const string &filename) {
+    PhaseTimer timer(Statistics::DETECT);
     auto &registrations=getRegistrations();
+    auto &index=getSignatureIndex();
+    
+    // Collect the signatures of all file types, most specific first
+    static std::mutex indexMutex;
+    std::unique_lock<std::mutex> lock(indexMutex);
+    if (!isSignatureIndexValid()) {
+        index.clear();
+        for (auto i=registrations.begin(); i!=registrations.end(); ++i)
+            for (auto j=(*i)->signatures.begin(); j!=(*i)->signatures.end(); ++j) {
+                unsigned weight=j->bytes.size()*8;
+                if (!j->mask.empty()) {
+                    weight=0;
+                    for (size_t k=0; k<j->mask.size(); k++)
+                        weight+=__builtin_popcount(uint8_t(j->mask[k]));
+                }
+                index.push_back({&*j, *i, weight});
+            }
+        std::stable_sort(index.begin(), index.end(), [](const SignatureEntry &a, const SignatureEntry &b) {
+            return a.weight>b.weight;
+        });
+        isSignatureIndexValid()=true;
+    }
+    lock.unlock();
+    
+    // Read the beginning of the file once and match every signature against it
+    Span head=is.span(is.tell(), std::min(is.available(), HEAD_SIZE));
+    for (auto i=index.begin(); i!=index.end(); ++i)
+        if (matches(*i->signature, head.data(), head.size()))
+            return i->registration;
     
+    // Fall back to the detect functions, which usually check the file extension
     for (auto i=registrations.begin(); i!=registrations.end(); ++i) {
         // `magicReader` is called magic not because it is magic itself, but
         // because it is intended for reading magic numbers
         BinaryReader magicReader(is);
         if ((*i)->detect(magicReader, filename))
-            return (*i)->extract;
+            return *i;
     }
     
     return nullptr;
 }
+
+TypeRegistration::ExtractFunction TypeRegistration::resolve(BinaryReader &is, const string &filename) {
+    const TypeRegistration * registration=identify(is, filename);
+    return registration?registration->extract:nullptr;
+}
+
+bool TypeRegistration::offer(const BinaryReader &payload, const Context &context, const string &name) {
+    if ((recursionLevel>=recursionDepth)||!context.wantsDirectory(name+".d"))
+        return false;
+    
+    BinaryReader is(payload, payload.tell(), payload.available());
+    string path=context.getPath(name);
+    const TypeRegistration * registration=identify(is, path);
+    if (!registration)
+        return false;
+    
+    Context nested(context, name+".d");
+    nested.addContainer(registration->getName(), is.debug(), is.available());
+    console() << "Unpacking " << path << " to " << nested.getOutputDir() << '\n';
+    nested.createDirectory();
+    // A parse error probably means a false detection, then the partial tree
+    // is removed and the payload is kept as it is. Other errors, such as a
+    // failed write, stop unpacking
+    auto fallBack=[&]() {
+        recursionLevel--;
+        if (context.writesFiles())
+            removeTree(nested.getOutputDir());
+        console() << "Cannot unpack " << path << ", saving it as a file" << '\n';
+        return false;
+    };
+    recursionLevel++;
+    try {
+        HandlerTimer timer(registration->getName());
+        TraceSpan span(registration->getName(), path, is.debug(), is.available());
+        registration->extract(is, nested);
+        recursionLevel--;
+        return true;
+    }
+    catch (const char * error) {
+        return fallBack();
+    }
+    catch (const std::string &error) {
+        return fallBack();
+    }
+    catch (const EOFException &error) {
+        return fallBack();
+    }
+    catch (...) {
+        recursionLevel--;
+        throw;
+    }
+}
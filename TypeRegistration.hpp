@@ -1,26 +1,63 @@
 #ifndef __TYPEREGISTRATION_HPP
 #define __TYPEREGISTRATION_HPP
 
+#include <cstddef>
+#include <iterator>
 #include <string>
 #include <vector>
+#include "Context.hpp"
 
 class BinaryReader;
 
+/** Set how many levels of nested containers are unpacked in memory (0: none) **/
+void setRecursionDepth(unsigned depth);
+/** Get the maximum nesting level of unpacked containers **/
+unsigned getRecursionDepth();
+
 /**/
 class TypeRegistration {
 public:
     using DetectFunction=bool(*)(BinaryReader &is, const std::string &filename);
-    using ExtractFunction=void(*)(BinaryReader &is, const std::string &outputDir);
+    using ExtractFunction=void(*)(BinaryReader &is, const Context &context);
+    /** Magic number at a fixed offset from the beginning of the file.
+        Only the bits set in `mask` are compared (all of them if it is empty) **/
+    struct Signature {
+        template<size_t N>
+        Signature(const char (&bytes)[N], size_t offset=0) :
+            offset(offset), bytes(bytes, N-1) {}
+        template<size_t N>
+        Signature(const char (&bytes)[N], const char (&mask)[N], size_t offset=0) :
+            offset(offset), bytes(bytes, N-1), mask(mask, N-1) {}
+        
+        size_t offset;
+        std::string bytes;
+        std::string mask;
+    };
+    /** Number of bytes read from the beginning of the file to match signatures **/
+    static constexpr size_t HEAD_SIZE=4096;
     /** Add a file type **/
-    TypeRegistration(const char * name, DetectFunction detect, ExtractFunction extract);
+    TypeRegistration(const char * name, DetectFunction detect, ExtractFunction extract,
+        const Signature * signaturesBegin=nullptr, const Signature * signaturesEnd=nullptr);
     /** Unregister this file type **/
     ~TypeRegistration();
     /** List the file types **/
     static std::vector<const char *> list();
     /** Get the extracter by its name **/
     static ExtractFunction get(const std::string &name);
-    /** Detect the type of file **/
+    /** Detect the type of file: match the signatures of all types against
+        the beginning of the file, then fall back to the detect functions **/
+    static const TypeRegistration * identify(BinaryReader &is, const std::string &filename);
+    /** Detect the type of file and return its extracter **/
     static ExtractFunction resolve(BinaryReader &is, const std::string &filename);
+    /** Offer a payload found inside another file: with recursive unpacking,
+        a payload of a known type is unpacked to the subdirectory `name`.d of
+        the context instead of being saved as `name`. Returns false if the
+        payload was not unpacked **/
+    static bool offer(const BinaryReader &payload, const Context &context, const std::string &name);
+    /** Name of the file type **/
+    const char * getName() const { return name; }
+    /** Extracter of the file type **/
+    ExtractFunction getExtract() const { return extract; }
     /** Always returns false **/
     static bool no(BinaryReader &is, const std::string &filename) { return false; }
     
@@ -31,11 +68,18 @@ private:
     const char * name;
     DetectFunction detect;
     ExtractFunction extract;
+    std::vector<Signature> signatures;
 };
 
 #define TR(name) \
     static const TypeRegistration _##name##_tr(#name, detect, extract)
 #define TR_NODETECT(name) \
     static const TypeRegistration _##name##_tr(#name, &TypeRegistration::no, extract)
+#define TR_MAGIC(name) \
+    static const TypeRegistration _##name##_tr(#name, detect, extract, \
+        std::begin(SIGNATURES), std::end(SIGNATURES))
+#define TR_MAGIC_NODETECT(name) \
+    static const TypeRegistration _##name##_tr(#name, &TypeRegistration::no, extract, \
+        std::begin(SIGNATURES), std::end(SIGNATURES))
 
 #endif
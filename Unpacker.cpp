@@ -0,0 +1,176 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include "Statistics.hpp"
+#include "StringUtils.hpp"
+#include "Trace.hpp"
+#include "TypeRegistration.hpp"
+#include "Unpacker.hpp"
+
+using std::string;
+
+extern void extractAndroidImage(BinaryReader &is, const Context &context, const string &filename);
+extern void extractSymbianImage(BinaryReader &is, const Context &context, Indent indent=Indent());
+
+/******************************************************************************/
+
+/** Memory owned by the caller **/
+class BufferSource : public Source {
+public:
+    BufferSource(const void * data, size_t size) : data(static_cast<const uint8_t *>(data)), size(size) {}
+    size_t getSize() const override { return size; }
+    size_t read(void * buffer, size_t length, off_t offset) override {
+        if (size_t(offset)>=size)
+            return 0;
+        length=std::min(length, size-offset);
+        memcpy(buffer, data+offset, length);
+        return length;
+    }
+    const uint8_t * map() const override { return data; }
+    
+private:
+    const uint8_t * data;
+    size_t size;
+};
+
+/** Input read through a callback, one block ahead so that small reads of
+    the headers do not call it every time **/
+class CallbackSource : public Source {
+public:
+    CallbackSource(const Unpacker::ReadFunction &callback, uint64_t size) :
+        callback(callback), size(size), block(BinaryReader::DEFAULT_BLOCK_SIZE), blockOffset(0), blockLength(0) {}
+    size_t getSize() const override { return size; }
+    size_t read(void * buffer, size_t length, off_t offset) override {
+        if (length>=block.size())
+            return callback(buffer, length, offset);
+        
+        if ((offset<blockOffset)||(offset+length>blockOffset+blockLength)) {
+            blockOffset=offset;
+            blockLength=callback(&block[0], block.size(), offset);
+        }
+        length=std::min(length, size_t(blockOffset+blockLength-offset));
+        memcpy(buffer, &block[offset-blockOffset], length);
+        return length;
+    }
+    
+private:
+    const Unpacker::ReadFunction &callback;
+    uint64_t size;
+    ByteArray block;
+    off_t blockOffset;
+    size_t blockLength;
+};
+
+/** Passes the files to the entry callback with the metadata reported for them **/
+class CallbackOutput : public Output, public EventSink {
+public:
+    CallbackOutput(const Unpacker::EntryFunction &onEntry, EventSink * events, bool listing) :
+        onEntry(onEntry), events(events), listing(listing) {}
+    void emit(const Event &event) override {
+        Event entry(event);
+        entry.path=relative(event.path);
+        if (events)
+            events->emit(entry);
+        if (event.type!=Event::FILE)
+            return;
+        else if (listing)
+            onEntry(entry);
+        else {
+            // Images assembled from blocks are reported block by block
+            auto i=entries.find(entry.path);
+            if (i==entries.end())
+                entries.emplace(entry.path, entry);
+            else
+                i->second.size+=entry.size;
+        }
+    }
+    bool wantsHashes() const override { return events&&events->wantsHashes(); }
+    std::unique_ptr<Sink> create(const string &path) override {
+        auto i=entries.find(relative(path));
+        if (i==entries.end()) {
+            size_t slash=path.rfind('/');
+            return onEntry(Event {Event::FILE, path.substr(slash+1), relative(path), 0, 0, nullptr, string()});
+        }
+        Event entry=std::move(i->second);
+        entries.erase(i);
+        return onEntry(entry);
+    }
+    
+private:
+    /** Paths are relative to the top of the input, which is `.` **/
+    static string relative(const string &path) {
+        size_t start=path.find_first_not_of('/', 1);
+        return start==string::npos?string():path.substr(start);
+    }
+    
+    const Unpacker::EntryFunction &onEntry;
+    EventSink * events;
+    bool listing;
+    /** Files which were reported but not written yet **/
+    std::map<string, Event> entries;
+};
+
+/******************************************************************************/
+
+Unpacker::Unpacker() : listing(false), events(nullptr), log(nullptr) {}
+
+const char * Unpacker::unpack(const void * data, size_t length, const string &name,
+        const EntryFunction &onEntry) const {
+    BinaryReader is(std::make_shared<BufferSource>(data, length));
+    return unpack(is, name, onEntry);
+}
+
+const char * Unpacker::unpack(const ReadFunction &read, uint64_t size, const string &name,
+        const EntryFunction &onEntry) const {
+    BinaryReader is(std::make_shared<CallbackSource>(read, size));
+    return unpack(is, name, onEntry);
+}
+
+const char * Unpacker::unpack(BinaryReader &is, const string &name, const EntryFunction &onEntry) const {
+    std::ostream discard(nullptr);
+    ConsoleRedirect redirect(log?*log:discard);
+    CallbackOutput output(onEntry, events, listing);
+    Context context(".", &output, listing, filter, &output);
+    
+    return unpack(is, name, type, context);
+}
+
+const char * Unpacker::unpack(BinaryReader &is, const string &name, const string &type, const Context &context) {
+    const char * format=nullptr;
+    TypeRegistration::ExtractFunction extract=nullptr;
+    if (!type.empty()) {
+        auto list=TypeRegistration::list();
+        for (auto i=list.begin(); i!=list.end()&&!format; ++i)
+            if (type==*i)
+                format=*i;
+        if (!format)
+            throw "Backend `"+type+"` does not exist";
+        extract=TypeRegistration::get(type);
+    }
+    else if (endsWith(name, ".android"))
+        format="android";
+    else if (endsWith(name, ".img"))
+        format="symbian";
+    else {
+        auto registration=TypeRegistration::identify(is, name);
+        if (!registration)
+            throw "cannot determine file type";
+        format=registration->getName();
+        extract=registration->getExtract();
+    }
+    
+    context.addContainer(format, is.debug(), is.available());
+    HandlerTimer timer(format);
+    TraceSpan span(format, is.debug(), is.available());
+    if (extract)
+        extract(is, context);
+    else if (format==string("android"))
+        extractAndroidImage(is, context, name.substr(name.rfind('/')+1));
+    else
+        extractSymbianImage(is, context);
+    return format;
+}
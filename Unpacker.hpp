@@ -0,0 +1,69 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ ******************************************************************************/
+
+#ifndef __UNPACKER_HPP
+#define __UNPACKER_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include "Context.hpp"
+#include "Events.hpp"
+#include "REUtils.hpp"
+#include "Sink.hpp"
+
+/** Unpacks files in the calling process without touching the file system:
+    the input is a memory buffer or a read callback, and the unpacked files
+    are passed to an entry callback. Errors are thrown as by the command line
+    tool: `const char *`, `std::string` or EOFException. An Unpacker may be
+    used by several threads at once. Nested containers are unpacked up to
+    the depth set with setRecursionDepth() **/
+class Unpacker {
+public:
+    /** Read up to `length` bytes at `offset`, return the number of bytes read **/
+    using ReadFunction=std::function<size_t(void * buffer, size_t length, uint64_t offset)>;
+    /** Called for every file with its path (relative to the top of the
+        input), offset, size and compression. Returns a sink for the contents,
+        which is destroyed at the end of the file, or nullptr to skip them **/
+    using EntryFunction=std::function<std::unique_ptr<Sink>(const Event &entry)>;
+    
+    Unpacker();
+    /** Use the format `type` (see TypeRegistration::list()) instead of detecting it **/
+    void setType(const std::string &type) { this->type=type; }
+    const std::string &getType() const { return type; }
+    /** Only report the entries; the sinks returned by the entry callback are not used **/
+    void setListing(bool listing) { this->listing=listing; }
+    /** Unpack only the entries selected by `filter` **/
+    void setFilter(std::shared_ptr<const Filter> filter) { this->filter=std::move(filter); }
+    /** Also report containers, blocks and directories to `events` **/
+    void setEvents(EventSink * events) { this->events=events; }
+    /** Write the messages of the handlers to `log` instead of discarding them **/
+    void setLog(std::ostream * log) { this->log=log; }
+    /** Unpack `length` bytes at `data`, which must stay valid during the
+        call. `name` is used to detect formats by extension. Returns the
+        name of the format **/
+    const char * unpack(const void * data, size_t length, const std::string &name,
+        const EntryFunction &onEntry) const;
+    /** Unpack `size` bytes read by `read` **/
+    const char * unpack(const ReadFunction &read, uint64_t size, const std::string &name,
+        const EntryFunction &onEntry) const;
+    /** Unpack the rest of `is` **/
+    const char * unpack(BinaryReader &is, const std::string &name, const EntryFunction &onEntry) const;
+    /** Unpack the rest of `is` to `context` with the format `type`, or the
+        one given by the extension of `name` or detected if `type` is empty.
+        Returns the name of the format **/
+    static const char * unpack(BinaryReader &is, const std::string &name, const std::string &type,
+        const Context &context);
+    
+private:
+    std::string type;
+    bool listing;
+    std::shared_ptr<const Filter> filter;
+    EventSink * events;
+    std::ostream * log;
+};
+
+#endif
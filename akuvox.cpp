@@ -7,14 +7,14 @@
 #include <cstring>
 #include <iostream>
 #include <openssl/evp.h>
-#include <optional>
 #include <unix++/FileSystem.hpp>
+#include "Codec.hpp"
+#include "Record.hpp"
 #include "REUtils.hpp"
+#include "Statistics.hpp"
 #include "StringUtils.hpp"
 #include "TypeRegistration.hpp"
 
-using std::cout;
-using std::endl;
 using std::string;
 using std::vector;
 
@@ -25,15 +25,18 @@ public:
         EVP_CIPHER_CTX_free(ctx);
     }
     void decryptInit(const EVP_CIPHER * type, ENGINE * impl, const unsigned char * key, const unsigned char * iv) {
+        PhaseTimer timer(Statistics::DECRYPT);
         check(EVP_DecryptInit_ex(ctx, type, impl, key, iv), "EVP_DecryptInit_ex()");
     }
     void setPadding(int padding) {
         check(EVP_CIPHER_CTX_set_padding(ctx, 0), "EVP_CIPHER_CTX_set_padding()");
     }
     void decryptUpdate(unsigned char * out, int &outl, const unsigned char * in, int inl) {
+        PhaseTimer timer(Statistics::DECRYPT);
         check(EVP_DecryptUpdate(ctx, out, &outl, in, inl), "EVP_DecryptUpdate()");
     }
     void decryptFinal(unsigned char * outm, int &outl) {
+        PhaseTimer timer(Statistics::DECRYPT);
         check(EVP_DecryptFinal_ex(ctx, outm, &outl), "EVP_DecryptFinal_ex()");
     }
     
@@ -80,6 +83,61 @@ static const SectionType SECTION_TYPES[]={
     {226,   "mtd6.md5",                         false,  false},
 };
 
+/** Beginning of the file, before the main header **/
+struct Preamble {
+    uint32_t headerSize;
+    uint32_t headerCRC;
+};
+
+using PreambleLayout=Layout<Preamble, Magic<'M', 'O', 'R', 'R'>,
+    LE<&Preamble::headerSize>, LE<&Preamble::headerCRC>>;
+
+struct Header {
+    uint32_t type;
+    uint32_t processType;
+    uint32_t sections;
+    uint32_t deviceId;
+    uint32_t oemId;
+    uint32_t romVersion;
+    uint32_t romSize;
+    uint32_t romChecksum;
+    uint32_t midVersion;
+    uint32_t swProtect;
+    uint32_t encryptionType;
+};
+
+using HeaderLayout=Layout<Header, LE<&Header::type>, LE<&Header::processType>,
+    LE<&Header::sections>, LE<&Header::deviceId>, LE<&Header::oemId>,
+    LE<&Header::romVersion>, LE<&Header::romSize>, LE<&Header::romChecksum>,
+    Skip<16>, LE<&Header::midVersion>, LE<&Header::swProtect>, Skip<52>,
+    LE<&Header::encryptionType>>;
+
+/** Section preamble, before the section header **/
+struct SectionPreamble {
+    uint32_t size;
+    uint32_t crc;
+};
+
+using SectionPreambleLayout=Layout<SectionPreamble, Magic<'T', 'A', 'P', 'R'>,
+    LE<&SectionPreamble::size>, LE<&SectionPreamble::crc>>;
+
+struct SectionHeader {
+    uint32_t sectionType;
+    uint32_t processType;
+    uint32_t dataType;
+    uint32_t id;
+    uint32_t version;
+    uint32_t dataLength;
+    uint32_t dataCRC;
+    uint32_t dataOffset;
+};
+
+using SectionHeaderLayout=Layout<SectionHeader, LE<&SectionHeader::sectionType>,
+    LE<&SectionHeader::processType>, LE<&SectionHeader::dataType>,
+    LE<&SectionHeader::id>, LE<&SectionHeader::version>,
+    LE<&SectionHeader::dataLength>, LE<&SectionHeader::dataCRC>,
+    LE<&SectionHeader::dataOffset>>;
+
 static const unsigned char ENCRYPTION_KEY[]="d3JpdGVfdXBncmFkZXJfYmluX3RvX2Zq";
 
 static string formatVersion(uint32_t version) {
@@ -100,139 +158,117 @@ static const SectionType &getSectionType(unsigned type) {
     return DEFAULT;
 }
 
-static void uncompressTo(const string &in, upp::File &output) {
-    // Read the input file
-    upp::File input(in.c_str(), O_RDONLY);
-    size_t inLength=input.seek(0, SEEK_END);
-    input.seek(0);
-    ByteArray inData(inLength);
-    input.read(&inData[0], inData.size());
-    
-    // Decompress the data
-    ByteArray outData=uncompress(inData);
-    
-    // Write the decompressed file
-    output.write(outData.data(), outData.size());
+/** Decrypt a section in memory: only its first 1KB is encrypted **/
+static BinaryReader decrypt(BinaryReader &data) {
+    ByteArray contents=data.readAll();
+    if (contents.size()>=1024) {
+        uint8_t iv[16];
+        memset(iv, 0x30, sizeof(iv));
+        
+        vector<uint8_t> plaintext(1024);
+        int p_len=int(plaintext.size()), f_len=0;
+        
+        CipherContext context;
+        context.decryptInit(EVP_aes_128_cbc(), nullptr, ENCRYPTION_KEY+8, iv);
+        context.setPadding(0);
+        context.decryptUpdate(&plaintext[0], p_len, &contents[0], plaintext.size());
+        context.decryptFinal(&plaintext[p_len], f_len);
+        std::copy(plaintext.begin(), plaintext.end(), contents.begin());
+    }
+    return BinaryReader(std::make_shared<MemorySource>(std::move(contents)));
 }
 
-static bool detect(BinaryReader &is, const string &filename) {
-    return is.readString(4)=="MORR";
+/** Decompress a section from memory, without reading back the exported file **/
+static void uncompressTo(const BinaryReader &data, Sink &output) {
+    Span compressed=data.span(0, data.getSize());
+    decode("zlib", compressed.data(), compressed.size(), output);
 }
 
-static void extract(BinaryReader &is, const string &dir) {
+static const TypeRegistration::Signature SIGNATURES[]={
+    {"MORR"},
+};
+
+static void extract(BinaryReader &is, const Context &context) {
     // Read main header
-    string magic=is.readString(4);
-    if (magic!="MORR")
-        throw "wrong magic (expected 'MORR')";
-    uint32_t headerSize=is.readIntLE();
-    uint32_t headerCRC=is.readIntLE();
-    BinaryReader header=is.window(headerSize);
-    uint32_t type=header.readIntLE();
-    uint32_t processType=header.readIntLE();
-    uint32_t sections=header.readIntLE();
-    uint32_t deviceId=header.readIntLE();
-    uint32_t oemId=header.readIntLE();
-    uint32_t romVersion=header.readIntLE();
-    uint32_t romSize=header.readIntLE();
-    uint32_t romChecksum=header.readIntLE();
-    header.skip(16u);
-    uint32_t midVersion=header.readIntLE();
-    uint32_t swProtect=header.readIntLE();
-    header.skip(52u);
-    uint32_t encryptionType=header.readIntLE();
+    Preamble preamble=is.readRecord<PreambleLayout>();
+    BinaryReader headerReader=is.window(preamble.headerSize);
+    Header header=headerReader.readRecord<HeaderLayout>();
+    uint32_t encryptionType=header.encryptionType;
     
-    cout << "Type: " << type << endl;
-    cout << "Process type: " << processType << endl;
-    cout << "Number of sections: " << sections << endl;
-    cout << "Device ID: " << deviceId << endl;
-    cout << "OEM ID: " << oemId << endl;
-    cout << "ROM version: " << formatVersion(romVersion) << endl;
-    cout << "ROM size: " << romSize << endl;
-    cout << "ROM checksum: " << romChecksum << endl;
-    cout << "MID version: " << midVersion << endl;
-    cout << "SW protect: " << swProtect << endl;
-    cout << "Encryption type: " << encryptionType << endl;
+    console() << "Type: " << header.type << '\n';
+    console() << "Process type: " << header.processType << '\n';
+    console() << "Number of sections: " << header.sections << '\n';
+    console() << "Device ID: " << header.deviceId << '\n';
+    console() << "OEM ID: " << header.oemId << '\n';
+    console() << "ROM version: " << formatVersion(header.romVersion) << '\n';
+    console() << "ROM size: " << header.romSize << '\n';
+    console() << "ROM checksum: " << header.romChecksum << '\n';
+    console() << "MID version: " << header.midVersion << '\n';
+    console() << "SW protect: " << header.swProtect << '\n';
+    console() << "Encryption type: " << encryptionType << '\n';
     
     // Uncompressed image
-    std::optional<upp::File> image;
+    std::unique_ptr<Sink> image;
+    bool imageStarted=false;
     
-    for (unsigned i=0; i<sections; i++) {
-        string sectionMagic=is.readString(4);
-        if (sectionMagic!="TAPR")
-            throw "wrong section magic (expected 'TAPR')";
-        uint32_t size=is.readIntLE();
-        uint32_t crc=is.readIntLE();
-        BinaryReader window=is.window(size);
-        uint32_t sectionType=window.readIntLE();
-        uint32_t processType=window.readIntLE();
-        uint32_t dataType=window.readIntLE();
-        uint32_t id=window.readIntLE();
-        uint32_t version=window.readIntLE();
-        uint32_t dataLength=window.readIntLE();
-        uint32_t dataCRC=window.readIntLE();
-        uint32_t dataOffset=window.readIntLE();
+    for (unsigned i=0; i<header.sections; i++) {
+        SectionPreamble sectionPreamble=is.readRecord<SectionPreambleLayout>();
+        BinaryReader window=is.window(sectionPreamble.size);
+        SectionHeader section=window.readRecord<SectionHeaderLayout>();
         
-        const SectionType &st=getSectionType(sectionType);
-        string sectionTypeStr=st.description?st.description:std::to_string(sectionType);
+        const SectionType &st=getSectionType(section.sectionType);
+        string sectionTypeStr=st.description?st.description:std::to_string(section.sectionType);
         
-        cout << "Section" << endl;
-        cout << "    Section type: " << sectionTypeStr << endl;
-        cout << "    Process type: " << processType << endl;
-        cout << "    Data type: " << dataType << endl;
-        cout << "    ID: " << id << endl;
-        cout << "    Version: " << formatVersion(version) << endl;
-        cout << "    Data length: " << dataLength << endl;
-        cout << "    Checksum: " << dataCRC << endl;
-        cout << "    Offset: " << dataOffset << endl;
+        console() << "Section" << '\n';
+        console() << "    Section type: " << sectionTypeStr << '\n';
+        console() << "    Process type: " << section.processType << '\n';
+        console() << "    Data type: " << section.dataType << '\n';
+        console() << "    ID: " << section.id << '\n';
+        console() << "    Version: " << formatVersion(section.version) << '\n';
+        console() << "    Data length: " << section.dataLength << '\n';
+        console() << "    Checksum: " << section.dataCRC << '\n';
+        console() << "    Offset: " << section.dataOffset << '\n';
         
-        BinaryReader data(is, dataOffset, dataLength);
-        mkdir(dir.c_str(), 0700);
-        string filename=dir+'/'+std::to_string(i)+"_"+sectionTypeStr;
-        if (st.encrypted&&(encryptionType==1)) {
-            // First 1KB of a section is encrypted
-            upp::File out(filename.c_str(), O_WRONLY|O_CREAT|O_TRUNC);
-            vector<uint8_t> ciphertext;
-            
-            ciphertext=data.read(1024);
-            if (ciphertext.size()<1024)
-                out.write(ciphertext.data(), ciphertext.size());
-            else {
-                uint8_t iv[16];
-                memset(iv, 0x30, sizeof(iv));
-                
-                vector<uint8_t> plaintext(ciphertext.size());
-                int p_len=int(plaintext.size()), f_len=0;
-                
-                CipherContext context;
-                context.decryptInit(EVP_aes_128_cbc(), nullptr, ENCRYPTION_KEY+8, iv);
-                context.setPadding(0);
-                context.decryptUpdate(&plaintext[0], p_len, &ciphertext[0], ciphertext.size());
-                context.decryptFinal(&plaintext[p_len], f_len);
-                out.write(plaintext.data(), plaintext.size());
-                
-                ciphertext=data.readAll();
-                if (!ciphertext.empty())
-                    out.write(ciphertext.data(), ciphertext.size());
-            }
-            cout << "    Decrypted and exported to " << filename << endl;
+        BinaryReader data(is, section.dataOffset, section.dataLength);
+        context.createDirectory();
+        string name=std::to_string(i)+"_"+sectionTypeStr;
+        string filename=context.getPath(name);
+        bool encrypted=st.encrypted&&(encryptionType==1);
+        // Compressed sections also make up a single image, listed once for every section
+        bool wanted=context.wants(name), inImage=st.compressed&&context.wants("mtd");
+        if (!context.wantsId(section.sectionType)||!(wanted||inImage))
+            continue;
+        
+        const char * compression=encrypted?(st.compressed?"aes+zlib":"aes"):(st.compressed?"zlib":nullptr);
+        if (inImage)
+            context.addEntry("mtd", data, compression);
+        if (context.isListing()) {
+            if (wanted)
+                context.addEntry(name, data, compression);
+            continue;
         }
+        BinaryReader payload=encrypted?decrypt(data):data;
+        
+        // Unpacked recursively, the section is reported as a container instead of a file
+        if (!wanted)
+            ;
+        else if (TypeRegistration::offer(payload, context, name))
+            ;
         else {
-            data.extract(filename);
-            cout << "    Exported to " << filename << endl;
+            context.addEntry(name, data, compression);
+            context.write(payload, name);
+            console() << (encrypted?"    Decrypted and exported to ":"    Exported to ") << filename << '\n';
         }
         
-        /*if (st.compressed) {
-            string unFilename=filename+".uncompressed";
-            uncompressFile(filename, unFilename);
-            cout << "    Uncompressed to " << unFilename << endl;
-        }*/
-        
-        if (st.compressed) {
-            if (!image)
-                image.emplace("akuvox/mtd", O_CREAT|O_WRONLY|O_TRUNC);
-            uncompressTo(filename, *image);
+        if (inImage) {
+            if (!imageStarted) {
+                image=context.create("mtd");
+                imageStarted=true;
+            }
+            if (image)
+                uncompressTo(payload, *image);
         }
     }
 }
 
-TR(akuvox);
+TR_MAGIC_NODETECT(akuvox);
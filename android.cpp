@@ -1,55 +1,68 @@
 #include <iostream>
+#include "Record.hpp"
 #include "REUtils.hpp"
 #include "StringUtils.hpp"
+#include "Context.hpp"
 
-using std::cout;
-using std::endl;
 using std::string;
 
+struct Header {
+    uint32_t kernelSize;
+    uint32_t kernelAddress;
+    uint32_t rdSize;
+    uint32_t rdAddress;
+    uint32_t rd2Size;
+    uint32_t rd2Address;
+    uint32_t tagsAddress;
+    uint32_t pageSize;
+    uint32_t headerVersion;
+    uint32_t osVersion;
+    string productName;
+};
+
+using HeaderLayout=Layout<Header, Magic<'A', 'N', 'D', 'R', 'O', 'I', 'D', '!'>,
+    LE<&Header::kernelSize>, LE<&Header::kernelAddress>, LE<&Header::rdSize>,
+    LE<&Header::rdAddress>, LE<&Header::rd2Size>, LE<&Header::rd2Address>,
+    LE<&Header::tagsAddress>, LE<&Header::pageSize>, LE<&Header::headerVersion>,
+    LE<&Header::osVersion>, String<&Header::productName, 16>>;
+
+struct Ids {
+    uint32_t ids[8];
+};
+
+using IdsLayout=Layout<Ids, LE<&Ids::ids>>;
+
 static uint32_t pages(uint32_t size, uint32_t pageSize) {
     return (size+pageSize-1)/pageSize;
 }
 
-static void extractPart(BinaryReader &is, uint32_t pageSize, uint32_t &offset, uint32_t size, const string &filename) {
+static void extractPart(BinaryReader &is, uint32_t pageSize, uint32_t &offset, uint32_t size,
+        const Context &context, const string &name) {
     if (size) {
         BinaryReader part(is, offset*pageSize, size);
-        part.extract(filename);
+        context.save(part, name);
         offset+=pages(size, pageSize);
     }
 }
 
-void extractAndroidImage(BinaryReader &is, const string &filename) {
-    string magic=is.readString(8u);
-    if (magic!="ANDROID!")
-        throw "invalid magic (expected 'ANDROID!')";
-    
-    uint32_t kernelSize=is.readIntLE();
-    uint32_t kernelAddress=is.readIntLE();
-    uint32_t rdSize=is.readIntLE();
-    uint32_t rdAddress=is.readIntLE();
-    uint32_t rd2Size=is.readIntLE();
-    uint32_t rd2Address=is.readIntLE();
-    uint32_t tagsAddress=is.readIntLE();
-    uint32_t pageSize=is.readIntLE();
-    uint32_t headerVersion=is.readIntLE();
-    uint32_t osVersion=is.readIntLE();
-    string productName=is.readString(16);
+/** Unpack a boot image named `filename` in the output directory of the context
+    next to it, as `filename` with the extension replaced by the part name **/
+void extractAndroidImage(BinaryReader &is, const Context &context, const string &filename) {
+    Header header=is.readRecord<HeaderLayout>();
     BinaryReader bootCmd=is.window(512);
-    uint32_t ids[8];
-    for (unsigned i=0; i<8; i++)
-        ids[i]=is.readIntLE();
+    Ids ids=is.readRecord<IdsLayout>();
     BinaryReader bootCmdExtra=is.window(1024);
-    if (headerVersion>0)
+    if (header.headerVersion>0)
         throw "TODO: read header fields for format v1 and v2";
     
-    cout << "Format version: " << headerVersion << endl;
+    console() << "Format version: " << header.headerVersion << '\n';
     for (unsigned i=0; i<8; i++)
-        cout << "[" << i << "]: " << ids[i] << endl;
+        console() << "[" << i << "]: " << ids.ids[i] << '\n';
     
-    bootCmd.extract(replaceExtension(filename, "bootcmd"));
-    bootCmdExtra.extract(replaceExtension(filename, "bootcmd-extra"));
+    context.save(bootCmd, replaceExtension(filename, "bootcmd"));
+    context.save(bootCmdExtra, replaceExtension(filename, "bootcmd-extra"));
     uint32_t offset=1; // in pages, not in bytes
-    extractPart(is, pageSize, offset, kernelSize, replaceExtension(filename, "kernel"));
-    extractPart(is, pageSize, offset, rdSize, replaceExtension(filename, "ramdisk"));
-    extractPart(is, pageSize, offset, rd2Size, replaceExtension(filename, "ramdisk2"));
+    extractPart(is, header.pageSize, offset, header.kernelSize, context, replaceExtension(filename, "kernel"));
+    extractPart(is, header.pageSize, offset, header.rdSize, context, replaceExtension(filename, "ramdisk"));
+    extractPart(is, header.pageSize, offset, header.rd2Size, context, replaceExtension(filename, "ramdisk2"));
 }
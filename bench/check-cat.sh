@@ -0,0 +1,50 @@
+#!/bin/sh
+# Checks that --cat gives every file of the synthetic inputs as unpacking saves it,
+# whether the index copies it straight from the input or unpacks it
+# Usage: check-cat.sh UNPACKER CORPUS OUTPUT
+
+if [ $# -ne 3 ]; then
+    echo "Usage: $0 UNPACKER CORPUS OUTPUT" >&2
+    exit 2
+fi
+unpacker=$1
+corpus=$2
+output=$3
+failed=0
+
+# check INPUT TYPE NAME [OPTIONS...]: unpack INPUT to OUTPUT/NAME, then --cat every file
+check() {
+    input=$1 type=$2 name=$3 directory=$output/$3
+    shift 3
+    rm -rf "$directory"
+    if ! "$unpacker" -t "$type" -o "$directory" "$@" "$input" > "$directory.log" 2>&1; then
+        echo "FAILED to unpack $input $*"
+        failed=1
+        return
+    fi
+    files=0 wrong=0
+    (cd "$directory" && find . -type f | sed 's|^\./||' | sort) > "$directory.files"
+    while IFS= read -r file; do
+        files=$((files+1))
+        if ! "$unpacker" -t "$type" "$@" --cat "$file" "$input" < /dev/null 2> /dev/null | cmp -s - "$directory/$file"; then
+            echo "  --cat $file differs"
+            wrong=$((wrong+1))
+        fi
+    done < "$directory.files"
+    echo "$name: $files files, $wrong differ"
+    [ $files -gt 0 ] && [ $wrong -eq 0 ] || failed=1
+}
+
+mkdir -p "$output"
+for input in "$corpus"/*; do
+    name=`basename "$input"`
+    type=`echo "$name" | sed 's/[-.].*//'`
+    check "$input" "$type" "$name"
+    check "$input" "$type" "$name-M" -M
+done
+# Nested containers: the ROFS image assembled from the blocks of an FPSX file,
+# which come under the same path, is unpacked to rofs.img.d
+for input in "$corpus"/fpsx*; do
+    check "$input" fpsx "`basename "$input"`-recursive" --recursive
+done
+exit $failed
@@ -0,0 +1,620 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ *  Generator of synthetic inputs of every supported format for benchmarks
+ ******************************************************************************/
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <openssl/evp.h>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+using std::string;
+using std::vector;
+
+using Bytes=vector<uint8_t>;
+
+/** What to generate **/
+struct Parameters {
+    /** Approximate size of the contents of all files **/
+    size_t size=64<<20;
+    /** Size of a file, resource or section when the format does not fix their number **/
+    size_t fileSize=64<<10;
+    /** Levels of subdirectories in ROFS and Qt resources **/
+    unsigned depth=3;
+    /** Subdirectories and files in every directory **/
+    unsigned fanout=4;
+};
+
+/** Deterministic pseudo-random numbers (xorshift), so that runs can be compared **/
+class Random {
+public:
+    explicit Random(uint64_t seed) : state(seed*0x9E3779B97F4A7C15ULL+1) {}
+    uint64_t next() {
+        state^=state<<13;
+        state^=state>>7;
+        state^=state<<17;
+        return state;
+    }
+    unsigned below(unsigned n) { return next()%n; }
+    
+private:
+    uint64_t state;
+};
+
+static void put8(Bytes &out, uint8_t value) {
+    out.push_back(value);
+}
+
+static void put16LE(Bytes &out, uint16_t value) {
+    put8(out, value);
+    put8(out, value>>8);
+}
+
+static void put32LE(Bytes &out, uint32_t value) {
+    put16LE(out, value);
+    put16LE(out, value>>16);
+}
+
+static void put64LE(Bytes &out, uint64_t value) {
+    put32LE(out, value);
+    put32LE(out, value>>32);
+}
+
+static void put16BE(Bytes &out, uint16_t value) {
+    put8(out, value>>8);
+    put8(out, value);
+}
+
+static void put32BE(Bytes &out, uint32_t value) {
+    put16BE(out, value>>16);
+    put16BE(out, value);
+}
+
+static void append(Bytes &out, const Bytes &data) {
+    out.insert(out.end(), data.begin(), data.end());
+}
+
+static void append(Bytes &out, const char * text) {
+    out.insert(out.end(), text, text+strlen(text));
+}
+
+/** Contents which compress roughly like firmware files: text, noise and padding **/
+static Bytes contents(size_t size, uint64_t seed) {
+    static const char * WORDS[]={"kernel ", "module ", "config=", "true\n", "Symbian ",
+        "resource ", "0x00000000 ", "image ", "<item name=\"", "\"/>\n"};
+    Random random(seed);
+    Bytes result;
+    result.reserve(size+64);
+    while (result.size()<size) {
+        unsigned kind=random.below(8);
+        if (kind<5)
+            append(result, WORDS[random.below(sizeof(WORDS)/sizeof(WORDS[0]))]);
+        else if (kind<7) {
+            for (unsigned i=0; i<16; i++)
+                put8(result, random.next());
+        }
+        else
+            result.insert(result.end(), 32, random.below(2)?0xFF:0x00);
+    }
+    result.resize(size);
+    return result;
+}
+
+/** zlib stream of `data` **/
+static Bytes deflated(const Bytes &data, bool gzip=false) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, gzip?31:15, 8, Z_DEFAULT_STRATEGY)!=Z_OK)
+        throw "deflateInit2()";
+    Bytes result(deflateBound(&stream, data.size())+32);
+    stream.next_in=const_cast<uint8_t *>(data.data());
+    stream.avail_in=data.size();
+    stream.next_out=result.data();
+    stream.avail_out=result.size();
+    int status=deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+    if (status!=Z_STREAM_END)
+        throw "deflate()";
+    result.resize(stream.total_out);
+    return result;
+}
+
+/** LZSS stream of `data` (4K window, 12-bit offsets, 4-bit lengths), found greedily **/
+static Bytes lzss(const Bytes &data) {
+    static const size_t WINDOW_SIZE=4096, MIN_LENGTH=3, MAX_LENGTH=18;
+    vector<int64_t> last(1<<16, -1);
+    Bytes result;
+    size_t flags=0;
+    unsigned item=8;
+    for (size_t i=0; i<data.size(); item++) {
+        if (item==8) {
+            flags=result.size();
+            put8(result, 0);
+            item=0;
+        }
+        size_t length=0, distance=0;
+        if (i+MIN_LENGTH<=data.size()) {
+            uint32_t key=((data[i]<<16)|(data[i+1]<<8)|data[i+2])*2654435761U>>16;
+            int64_t candidate=last[key];
+            last[key]=i;
+            if ((candidate>=0)&&(i-candidate<WINDOW_SIZE)) {
+                distance=i-candidate;
+                while ((length<MAX_LENGTH)&&(i+length<data.size())&&(data[candidate+length]==data[i+length]))
+                    length++;
+            }
+        }
+        if (length>=MIN_LENGTH) {
+            put8(result, ((length-MIN_LENGTH)<<4)|(distance>>8));
+            put8(result, distance);
+            i+=length;
+        }
+        else {
+            result[flags]|=1<<item;
+            put8(result, data[i++]);
+        }
+    }
+    return result;
+}
+
+/******************************************************************************/
+
+/** Virtual address of the beginning of a ROFS image **/
+static const uint32_t ROFS_BASE=0x1000;
+/** The root directory follows the header **/
+static const uint32_t ROFS_ROOT=0x30;
+
+static Bytes rofsEntry(const string &name, uint32_t size, uint32_t address) {
+    Bytes entry;
+    put16LE(entry, 30+2*name.size());
+    entry.resize(entry.size()+18);
+    put32LE(entry, size);
+    put32LE(entry, address);
+    put8(entry, 0);
+    put8(entry, name.size());
+    for (size_t i=0; i<name.size(); i++)
+        put16LE(entry, uint8_t(name[i]));
+    return entry;
+}
+
+/** ROFS tree of `fanout` subdirectories and files in every directory, `depth` levels deep **/
+class RofsBuilder {
+public:
+    explicit RofsBuilder(const Parameters &parameters) : parameters(parameters), seed(0) {
+        size_t directories=1;
+        for (unsigned level=0, count=1; level<parameters.depth; level++)
+            directories+=count*=parameters.fanout;
+        fileSize=std::max<size_t>(1, parameters.size/(directories*parameters.fanout));
+    }
+    Bytes build() {
+        // Room for the header and the root, which is made last
+        size_t rootSize=12;
+        if (parameters.depth)
+            for (unsigned i=0; i<parameters.fanout; i++)
+                rootSize+=30+2*directoryName(i).size();
+        image.assign(ROFS_ROOT+rootSize, 0);
+        auto root=addDirectory(0);
+        
+        Bytes header;
+        put32LE(header, 0x53464F52);
+        put8(header, 48);
+        put8(header, 0);
+        put16BE(header, 1);
+        put32LE(header, root.first);
+        put32LE(header, root.second);
+        put32LE(header, 0);
+        put32LE(header, 0);
+        put64LE(header, 0);
+        put8(header, 1);
+        put8(header, 0);
+        put16BE(header, 1);
+        put32BE(header, image.size());
+        put32BE(header, 0);
+        put32BE(header, image.size());
+        std::copy(header.begin(), header.end(), image.begin());
+        return std::move(image);
+    }
+    
+private:
+    static string directoryName(unsigned i) { return "dir"+std::to_string(i); }
+    /** Add the directory with its subtree, returns its address and size **/
+    std::pair<uint32_t, uint32_t> addDirectory(unsigned level) {
+        Bytes entries;
+        if (level<parameters.depth)
+            for (unsigned i=0; i<parameters.fanout; i++) {
+                auto subdirectory=addDirectory(level+1);
+                append(entries, rofsEntry(directoryName(i), subdirectory.second, subdirectory.first));
+            }
+        
+        Bytes files;
+        for (unsigned i=0; i<parameters.fanout; i++) {
+            uint32_t address=ROFS_BASE+image.size();
+            append(image, contents(fileSize, seed++));
+            append(files, rofsEntry("file"+std::to_string(i)+".bin", fileSize, address));
+        }
+        uint32_t filesAddress=ROFS_BASE+image.size();
+        append(image, files);
+        
+        Bytes block;
+        put16LE(block, 10+entries.size());
+        put8(block, 0);
+        put8(block, 12);
+        put32LE(block, filesAddress);
+        put32LE(block, files.size());
+        append(block, entries);
+        if (level==0) {
+            std::copy(block.begin(), block.end(), image.begin()+ROFS_ROOT);
+            return std::make_pair(ROFS_BASE+ROFS_ROOT, block.size()-2);
+        }
+        uint32_t address=ROFS_BASE+image.size();
+        append(image, block);
+        return std::make_pair(address, block.size()-2);
+    }
+    
+    const Parameters &parameters;
+    size_t fileSize;
+    uint64_t seed;
+    Bytes image;
+};
+
+static Bytes generateROFS(const Parameters &parameters) {
+    return RofsBuilder(parameters).build();
+}
+
+/** FPSX with a TLV header and binary blocks carrying a ROFS image **/
+static Bytes generateFPSX(const Parameters &parameters) {
+    static const size_t BLOCK_SIZE=128<<10;
+    Bytes image=generateROFS(parameters);
+    
+    Bytes tlv;
+    put32BE(tlv, 2);
+    put8(tlv, 244);
+    put8(tlv, 5);
+    append(tlv, "bench");
+    put8(tlv, 230);
+    put8(tlv, 4);
+    put32BE(tlv, 0x01020304);
+    
+    Bytes result;
+    put8(result, 0xB2);
+    put32BE(result, tlv.size());
+    append(result, tlv);
+    for (size_t offset=0; offset<image.size(); offset+=BLOCK_SIZE) {
+        size_t length=std::min(BLOCK_SIZE, image.size()-offset);
+        Bytes header;
+        put8(header, 0x54);
+        put16BE(header, 0);
+        put16BE(header, 0);
+        put8(header, 0);
+        put32BE(header, length);
+        put32BE(header, offset);
+        put8(header, 0);
+        
+        put8(result, 0x54);
+        put8(result, 0);
+        put8(result, 0x17);
+        put8(result, header.size());
+        append(result, header);
+        put8(result, 0);
+        result.insert(result.end(), image.begin()+offset, image.begin()+offset+length);
+    }
+    return result;
+}
+
+/** Chromium resource package of `version` 4 or 5, every fourth resource gzipped **/
+static Bytes generateChromium(const Parameters &parameters, unsigned version) {
+    size_t count=std::min<size_t>(std::max<size_t>(1, parameters.size/parameters.fileSize), 60000);
+    size_t aliases=version==5?count/16:0;
+    
+    Bytes header;
+    put32LE(header, version);
+    if (version==4) {
+        put32LE(header, count);
+        put8(header, 1);
+    }
+    else {
+        put8(header, 1);
+        header.resize(header.size()+3);
+        put16LE(header, count);
+        put16LE(header, aliases);
+    }
+    
+    // The table ends with a sentinel entry
+    Bytes data;
+    Bytes table;
+    size_t start=header.size()+6*(count+1)+4*aliases;
+    for (size_t i=0; i<count; i++) {
+        put16LE(table, 100+i);
+        put32LE(table, start+data.size());
+        Bytes resource=contents(parameters.fileSize, i);
+        append(data, i%4==3?deflated(resource, true):resource);
+    }
+    put16LE(table, 0);
+    put32LE(table, start+data.size());
+    for (size_t i=0; i<aliases; i++) {
+        put16LE(table, 62000+i);
+        put16LE(table, i*16);
+    }
+    
+    append(header, table);
+    append(header, data);
+    return header;
+}
+
+/** Qt resources (rcc version 1), every other file compressed **/
+static Bytes generateQt(const Parameters &parameters) {
+    struct Node {
+        bool directory;
+        unsigned level;
+        uint32_t name;
+        uint32_t count;
+        uint32_t first;
+        uint32_t data;
+        bool compressed;
+    };
+    
+    Bytes names, data;
+    auto addName=[&names](const string &name) {
+        uint32_t offset=names.size();
+        put16BE(names, name.size());
+        put32BE(names, 0);
+        for (size_t i=0; i<name.size(); i++)
+            put16BE(names, uint8_t(name[i]));
+        return offset;
+    };
+    
+    size_t directories=1;
+    for (unsigned level=0, count=1; level<parameters.depth; level++)
+        directories+=count*=parameters.fanout;
+    size_t fileSize=std::max<size_t>(1, parameters.size/(directories*parameters.fanout));
+    
+    // Children of a directory are consecutive, so the tree is laid out breadth first
+    vector<Node> nodes {Node {true, 0, addName(string()), 0, 0, 0, false}};
+    uint64_t seed=0;
+    for (size_t i=0; i<nodes.size(); i++) {
+        if (!nodes[i].directory)
+            continue;
+        unsigned level=nodes[i].level;
+        nodes[i].first=nodes.size();
+        if (level<parameters.depth)
+            for (unsigned j=0; j<parameters.fanout; j++)
+                nodes.push_back(Node {true, level+1, addName("dir"+std::to_string(j)), 0, 0, 0, false});
+        for (unsigned j=0; j<parameters.fanout; j++) {
+            bool compressed=j%2==0;
+            Bytes file=contents(fileSize, seed++);
+            uint32_t offset=data.size();
+            if (compressed) {
+                Bytes compressedFile=deflated(file);
+                put32BE(data, compressedFile.size()+4);
+                put32BE(data, file.size());
+                append(data, compressedFile);
+            }
+            else {
+                put32BE(data, file.size());
+                append(data, file);
+            }
+            nodes.push_back(Node {false, level, addName("file"+std::to_string(j)+".bin"), 0, 0, offset,
+                compressed});
+        }
+        nodes[i].count=nodes.size()-nodes[i].first;
+    }
+    
+    Bytes tree;
+    for (auto i=nodes.begin(); i!=nodes.end(); ++i) {
+        put32BE(tree, i->name);
+        if (i->directory) {
+            put16BE(tree, 2);
+            put32BE(tree, i->count);
+            put32BE(tree, i->first);
+        }
+        else {
+            put16BE(tree, i->compressed?1:0);
+            put16BE(tree, 0);
+            put16BE(tree, 0);
+            put32BE(tree, i->data);
+        }
+    }
+    
+    Bytes result;
+    put32BE(result, 0x71726573);
+    put32BE(result, 1);
+    put32BE(result, 20);
+    put32BE(result, 20+tree.size());
+    put32BE(result, 20+tree.size()+data.size());
+    append(result, tree);
+    append(result, data);
+    append(result, names);
+    return result;
+}
+
+/** Encrypt the first kilobyte of the section like Akuvox does **/
+static void encryptAkuvox(Bytes &data) {
+    static const unsigned char KEY[]="d3JpdGVfdXBncmFkZXJfYmluX3RvX2Zq";
+    if (data.size()<1024)
+        return;
+    unsigned char iv[16];
+    memset(iv, 0x30, sizeof(iv));
+    EVP_CIPHER_CTX * context=EVP_CIPHER_CTX_new();
+    int length=0, finalLength=0;
+    bool ok=context&&(EVP_EncryptInit_ex(context, EVP_aes_128_cbc(), nullptr, KEY+8, iv)==1)&&
+        (EVP_CIPHER_CTX_set_padding(context, 0)==1)&&
+        (EVP_EncryptUpdate(context, data.data(), &length, data.data(), 1024)==1)&&
+        (EVP_EncryptFinal_ex(context, data.data()+length, &finalLength)==1);
+    EVP_CIPHER_CTX_free(context);
+    if (!ok)
+        throw "cannot encrypt a section";
+}
+
+/** Akuvox MORR image with plain, encrypted and compressed TAPR sections **/
+static Bytes generateAkuvox(const Parameters &parameters) {
+    // Flash partition, upgrader tool, system.img, bootloader and compressed mtd partitions
+    static const unsigned TYPES[]={0, 1, 4, 9, 200, 201, 202, 203};
+    static const size_t COUNT=sizeof(TYPES)/sizeof(TYPES[0]);
+    static const size_t HEADER_SIZE=112, SECTION_SIZE=32;
+    
+    vector<Bytes> sections;
+    for (size_t i=0; i<COUNT; i++) {
+        Bytes section=contents(parameters.size/COUNT, i);
+        if (TYPES[i]>=200)
+            section=deflated(section);
+        if (TYPES[i]!=1)
+            encryptAkuvox(section);
+        sections.push_back(std::move(section));
+    }
+    
+    Bytes result;
+    append(result, "MORR");
+    put32LE(result, HEADER_SIZE);
+    put32LE(result, 0);
+    put32LE(result, 1);
+    put32LE(result, 2);
+    put32LE(result, COUNT);
+    put32LE(result, 3);
+    put32LE(result, 4);
+    put32LE(result, 0x01020304);
+    put32LE(result, parameters.size);
+    put32LE(result, 0);
+    result.resize(result.size()+16);
+    put32LE(result, 7);
+    put32LE(result, 8);
+    result.resize(result.size()+52);
+    put32LE(result, 1);
+    
+    size_t offset=result.size()+COUNT*(12+SECTION_SIZE);
+    for (size_t i=0; i<COUNT; i++) {
+        append(result, "TAPR");
+        put32LE(result, SECTION_SIZE);
+        put32LE(result, 0);
+        put32LE(result, TYPES[i]);
+        put32LE(result, 0);
+        put32LE(result, 0);
+        put32LE(result, i);
+        put32LE(result, 0x01000000);
+        put32LE(result, sections[i].size());
+        put32LE(result, 0);
+        put32LE(result, offset);
+        offset+=sections[i].size();
+    }
+    for (size_t i=0; i<COUNT; i++)
+        append(result, sections[i]);
+    return result;
+}
+
+/** Haier firmware: LZSS segments found by their magic number at aligned offsets **/
+static Bytes generateHaier(const Parameters &parameters) {
+    size_t count=std::max<size_t>(1, parameters.size/parameters.fileSize);
+    Bytes result;
+    for (size_t i=0; i<count; i++) {
+        Bytes segment=lzss(contents(parameters.fileSize, i));
+        put32BE(result, 0x55AA5AA5);
+        put32BE(result, i);
+        put32BE(result, segment.size());
+        append(result, segment);
+        result.resize((result.size()+3)&~size_t(3));
+    }
+    return result;
+}
+
+/** A baseline JPEG of about `size` bytes, as far as detectJPEG() cares **/
+static Bytes jpeg(size_t size, Random &random) {
+    Bytes result;
+    put16BE(result, 0xFFD8);
+    put16BE(result, 0xFFE0);
+    put16BE(result, 16);
+    append(result, "JFIF");
+    result.insert(result.end(), {0, 1, 1, 0, 0, 1, 0, 1, 0, 0});
+    put16BE(result, 0xFFDB);
+    put16BE(result, 67);
+    for (unsigned i=0; i<65; i++)
+        put8(result, 1+random.below(64));
+    put16BE(result, 0xFFDA);
+    put16BE(result, 12);
+    result.insert(result.end(), {3, 1, 0, 2, 0x11, 3, 0x11, 0, 0x3F, 0});
+    
+    // Entropy-coded data, where 0xFF is stuffed
+    while (result.size()<size) {
+        uint8_t byte=random.next();
+        put8(result, byte);
+        if (byte==0xFF)
+            put8(result, 0x00);
+    }
+    put16BE(result, 0xFFD9);
+    return result;
+}
+
+/** A blob with JPEG images between runs of data without markers **/
+static Bytes generateImages(const Parameters &parameters) {
+    Random random(1);
+    Bytes result;
+    while (result.size()<parameters.size) {
+        size_t gap=parameters.fileSize/2+random.below(parameters.fileSize);
+        for (size_t i=0; i<gap; i++)
+            put8(result, random.below(255));
+        append(result, jpeg(parameters.fileSize, random));
+    }
+    return result;
+}
+
+/******************************************************************************/
+
+static const struct {
+    const char * name;
+    Bytes (*generate)(const Parameters &parameters);
+} FORMATS[]={
+    {"akuvox", generateAkuvox},
+    {"chromium-v4", [](const Parameters &parameters) { return generateChromium(parameters, 4); }},
+    {"chromium-v5", [](const Parameters &parameters) { return generateChromium(parameters, 5); }},
+    {"fpsx", generateFPSX},
+    {"haier", generateHaier},
+    {"images", generateImages},
+    {"qt", generateQt},
+    {"rofs", generateROFS},
+};
+
+int main(int argc, char ** argv) {
+    if (argc<4) {
+        fprintf(stderr, "Usage: %s FORMAT SIZE_MB OUTPUT [--depth=N] [--fanout=N] [--file-size=BYTES]\n"
+            "Formats:", argv[0]);
+        for (auto i=std::begin(FORMATS); i!=std::end(FORMATS); ++i)
+            fprintf(stderr, " %s", i->name);
+        fprintf(stderr, "\n");
+        return 2;
+    }
+    
+    Parameters parameters;
+    parameters.size=strtod(argv[2], nullptr)*(1<<20);
+    for (int i=4; i<argc; i++) {
+        if (strncmp(argv[i], "--depth=", 8)==0)
+            parameters.depth=strtoul(argv[i]+8, nullptr, 0);
+        else if (strncmp(argv[i], "--fanout=", 9)==0)
+            parameters.fanout=std::max(1UL, strtoul(argv[i]+9, nullptr, 0));
+        else if (strncmp(argv[i], "--file-size=", 12)==0)
+            parameters.fileSize=std::max(1UL, strtoul(argv[i]+12, nullptr, 0));
+        else {
+            fprintf(stderr, "%s: unknown option %s\n", argv[0], argv[i]);
+            return 2;
+        }
+    }
+    
+    for (auto i=std::begin(FORMATS); i!=std::end(FORMATS); ++i)
+        if (strcmp(i->name, argv[1])==0) {
+            try {
+                Bytes data=i->generate(parameters);
+                std::ofstream output(argv[3], std::ios::binary|std::ios::trunc);
+                if (!output.write(reinterpret_cast<const char *>(data.data()), data.size()))
+                    throw "cannot write the output";
+                return 0;
+            }
+            catch (const char * error) {
+                fprintf(stderr, "%s: %s\n", argv[0], error);
+                return 1;
+            }
+        }
+    fprintf(stderr, "%s: unknown format %s\n", argv[0], argv[1]);
+    return 2;
+}
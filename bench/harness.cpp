@@ -0,0 +1,187 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ *  Throughput of every handler on the inputs made by bench/generate
+ ******************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <string>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+/** Outcome of running the unpacker once **/
+struct Run {
+    double seconds;
+    int status;
+    struct rusage usage;
+};
+
+/** Start the unpacker with its output discarded; with `trace`, stopped before it starts **/
+static pid_t start(const vector<string> &arguments, bool trace) {
+    pid_t pid=fork();
+    if (pid<0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid==0) {
+        int null=open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        if (trace) {
+            if (ptrace(PTRACE_TRACEME, 0, nullptr, nullptr)<0)
+                _exit(126);
+            raise(SIGSTOP);
+        }
+        vector<char *> argv;
+        for (auto i=arguments.begin(); i!=arguments.end(); ++i)
+            argv.push_back(const_cast<char *>(i->c_str()));
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    return pid;
+}
+
+static Run run(const vector<string> &arguments) {
+    Run result;
+    auto begin=std::chrono::steady_clock::now();
+    pid_t pid=start(arguments, false);
+    wait4(pid, &result.status, 0, &result.usage);
+    std::chrono::duration<double> elapsed=std::chrono::steady_clock::now()-begin;
+    result.seconds=elapsed.count();
+    return result;
+}
+
+/** System calls made by the unpacker and all its threads, -1 if it cannot be traced **/
+static long countSyscalls(const vector<string> &arguments) {
+    pid_t pid=start(arguments, true);
+    int status;
+    if ((waitpid(pid, &status, 0)<0)||!WIFSTOPPED(status))
+        return -1;
+    long options=PTRACE_O_TRACESYSGOOD|PTRACE_O_TRACECLONE|PTRACE_O_TRACEEXEC|PTRACE_O_EXITKILL;
+    if ((ptrace(PTRACE_SETOPTIONS, pid, nullptr, options)<0)||(ptrace(PTRACE_SYSCALL, pid, nullptr, nullptr)<0)) {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+        return -1;
+    }
+    
+    // Every system call stops at its entry and at its exit
+    long stops=0;
+    for (pid_t thread; (thread=waitpid(-1, &status, __WALL))>0;) {
+        if (!WIFSTOPPED(status))
+            continue;
+        int signal=WSTOPSIG(status);
+        if (signal==(SIGTRAP|0x80)) {
+            stops++;
+            signal=0;
+        }
+        else if ((signal==SIGTRAP)||(signal==SIGSTOP))
+            signal=0;   // ptrace events and new threads
+        ptrace(PTRACE_SYSCALL, thread, nullptr, reinterpret_cast<void *>(long(signal)));
+    }
+    return stops/2;
+}
+
+static size_t files;
+
+static int countFile(const char * path, const struct stat * st, int type, struct FTW * ftw) {
+    if (type==FTW_F)
+        files++;
+    return 0;
+}
+
+/** Number of files in the directory tree **/
+static size_t countFiles(const string &directory) {
+    files=0;
+    nftw(directory.c_str(), countFile, 16, FTW_PHYS);
+    return files;
+}
+
+static int removeFile(const char * path, const struct stat * st, int type, struct FTW * ftw) {
+    remove(path);
+    return 0;
+}
+
+static void removeTree(const string &directory) {
+    nftw(directory.c_str(), removeFile, 16, FTW_DEPTH|FTW_PHYS);
+}
+
+int main(int argc, char ** argv) {
+    if (argc<4) {
+        fprintf(stderr, "Usage: %s UNPACKER CORPUS OUTPUT [ROUNDS]\n", argv[0]);
+        return 2;
+    }
+    string unpacker=argv[1], corpus=argv[2], output=argv[3];
+    unsigned rounds=argc>4?std::max(1UL, strtoul(argv[4], nullptr, 0)):3;
+    
+    vector<string> inputs;
+    if (DIR * directory=opendir(corpus.c_str())) {
+        while (struct dirent * entry=readdir(directory))
+            if (entry->d_name[0]!='.')
+                inputs.push_back(entry->d_name);
+        closedir(directory);
+    }
+    std::sort(inputs.begin(), inputs.end());
+    if (inputs.empty()) {
+        fprintf(stderr, "%s: no inputs in %s\n", argv[0], corpus.c_str());
+        return 1;
+    }
+    
+    printf("%-16s %8s %8s %9s %8s %10s %9s %8s %8s %8s\n", "Input", "MB", "Seconds", "MB/s",
+        "Entries", "Entries/s", "Syscalls", "RSS MB", "User s", "Sys s");
+    bool failed=false;
+    for (auto i=inputs.begin(); i!=inputs.end(); ++i) {
+        // The type is the name up to the variant or the extension
+        string path=corpus+'/'+*i, type=i->substr(0, i->find_first_of("-."));
+        vector<string> arguments {unpacker, "-t", type, "-o", output, path};
+        struct stat st;
+        stat(path.c_str(), &st);
+        double megabytes=st.st_size/1e6;
+        
+        // The best of the rounds, after the input is in the page cache
+        Run best {0, 0};
+        long peakRSS=0;
+        size_t entries=0;
+        for (unsigned round=0; round<rounds; round++) {
+            removeTree(output);
+            Run current=run(arguments);
+            if (!WIFEXITED(current.status)||WEXITSTATUS(current.status)) {
+                best=current;
+                break;
+            }
+            entries=countFiles(output);
+            peakRSS=std::max(peakRSS, current.usage.ru_maxrss);
+            if ((round==0)||(current.seconds<best.seconds))
+                best=current;
+        }
+        if (!WIFEXITED(best.status)||WEXITSTATUS(best.status)) {
+            printf("%-16s %8.1f failed with status %d\n", i->c_str(), megabytes, best.status);
+            failed=true;
+            continue;
+        }
+        removeTree(output);
+        long syscalls=countSyscalls(arguments);
+        removeTree(output);
+        
+        double user=best.usage.ru_utime.tv_sec+best.usage.ru_utime.tv_usec/1e6;
+        double system=best.usage.ru_stime.tv_sec+best.usage.ru_stime.tv_usec/1e6;
+        printf("%-16s %8.1f %8.3f %9.1f %8zu %10.0f %9s %8.1f %8.3f %8.3f\n", i->c_str(), megabytes,
+            best.seconds, megabytes/best.seconds, entries, entries/best.seconds,
+            syscalls<0?"-":std::to_string(syscalls).c_str(), peakRSS/1024.0, user, system);
+    }
+    return failed?1:0;
+}
@@ -0,0 +1,124 @@
+/*******************************************************************************
+ *  FPSX/ROFS unpacking program
+ *  UTF-16 to UTF-8 transcoding microbenchmark
+ ******************************************************************************/
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "../StringUtils.hpp"
+
+using std::string;
+using std::vector;
+
+/** Reference implementation: one code unit at a time **/
+static string reference(const vector<uint16_t> &in) {
+    string result;
+    for (size_t i=0; i<in.size(); i++) {
+        uint32_t c=in[i];
+        if ((c>=0xD800)&&(c<0xE000)) {
+            if ((c<0xDC00)&&(i+1<in.size())&&(in[i+1]>=0xDC00)&&(in[i+1]<0xE000))
+                c=0x10000+((c-0xD800)<<10)+(in[++i]-0xDC00);
+            else
+                c=0xFFFD;
+        }
+        if (c<0x80)
+            result.push_back(c);
+        else if (c<0x800) {
+            result.push_back(0xC0|(c>>6));
+            result.push_back(0x80|(c&63));
+        }
+        else if (c<0x10000) {
+            result.push_back(0xE0|(c>>12));
+            result.push_back(0x80|((c>>6)&63));
+            result.push_back(0x80|(c&63));
+        }
+        else {
+            result.push_back(0xF0|(c>>18));
+            result.push_back(0x80|((c>>12)&63));
+            result.push_back(0x80|((c>>6)&63));
+            result.push_back(0x80|(c&63));
+        }
+    }
+    return result;
+}
+
+/** Generate a name table: count names of the given length drawn from alphabet **/
+static vector<uint16_t> generate(const vector<uint16_t> &alphabet, size_t total) {
+    vector<uint16_t> result(total);
+    uint32_t state=12345;
+    for (size_t i=0; i<total; i++) {
+        state=state*1103515245+12345;
+        result[i]=alphabet[(state>>16)%alphabet.size()];
+    }
+    return result;
+}
+
+static vector<uint16_t> swapped(const vector<uint16_t> &in) {
+    vector<uint16_t> result(in.size());
+    for (size_t i=0; i<in.size(); i++)
+        result[i]=__builtin_bswap16(in[i]);
+    return result;
+}
+
+/** Keeps the optimizer from discarding the results **/
+static volatile size_t sink;
+
+template<class F> static double measure(size_t bytes, F function) {
+    const unsigned ROUNDS=20;
+    auto start=std::chrono::steady_clock::now();
+    for (unsigned i=0; i<ROUNDS; i++)
+        function();
+    std::chrono::duration<double> elapsed=std::chrono::steady_clock::now()-start;
+    return bytes*double(ROUNDS)/elapsed.count()/1e6;
+}
+
+int main() {
+    const size_t NAME_LENGTH=24, NAMES=1<<16;
+    struct {
+        const char * name;
+        vector<uint16_t> alphabet;
+    } CASES[]={
+        {"ascii",       {'a', 'b', 'c', 'x', 'y', 'z', '0', '9', '_', '.'}},
+        {"latin",       {'a', 'b', 'c', 0xE9, 0xFC, 0xDF, '.', '_'}},
+        {"cjk",         {0x4E2D, 0x6587, 0x6A94, 0x6848, 0x540D}},
+        {"surrogates",  {0xD83D, 0xDE00, 'a', 0xDC00, 0xD800}},
+    };
+    
+    int status=0;
+    printf("%-12s %12s %12s %12s %12s\n", "case", "scalar MB/s", "LE MB/s", "BE MB/s", "names/s");
+    for (auto &c: CASES) {
+        vector<uint16_t> le=generate(c.alphabet, NAME_LENGTH*NAMES), be=swapped(le);
+        size_t bytes=le.size()*2;
+        
+        // Check every name against the reference first
+        for (size_t i=0; i<NAMES; i++) {
+            vector<uint16_t> name(le.begin()+i*NAME_LENGTH, le.begin()+(i+1)*NAME_LENGTH);
+            string expected=reference(name);
+            if ((utf16ToUtf8(&le[i*NAME_LENGTH], NAME_LENGTH, false)!=expected)||
+                (utf16ToUtf8(&be[i*NAME_LENGTH], NAME_LENGTH, true)!=expected)) {
+                printf("%s: mismatch in name %zu\n", c.name, i);
+                status=1;
+                break;
+            }
+        }
+        
+        double scalar=measure(bytes, [&] {
+            for (size_t i=0; i<NAMES; i++)
+                sink+=reference(vector<uint16_t>(le.begin()+i*NAME_LENGTH, le.begin()+(i+1)*NAME_LENGTH)).size();
+        });
+        double little=measure(bytes, [&] {
+            for (size_t i=0; i<NAMES; i++)
+                sink+=utf16ToUtf8(&le[i*NAME_LENGTH], NAME_LENGTH, false).size();
+        });
+        double big=measure(bytes, [&] {
+            for (size_t i=0; i<NAMES; i++)
+                sink+=utf16ToUtf8(&be[i*NAME_LENGTH], NAME_LENGTH, true).size();
+        });
+        printf("%-12s %12.1f %12.1f %12.1f %12.0f\n", c.name, scalar, little, big,
+            little*1e6/(NAME_LENGTH*2));
+    }
+    return status;
+}
@@ -4,15 +4,13 @@
  *  © 2023—2024, Sauron <unpacker@saur0n.science>
  ******************************************************************************/
 
+#include <algorithm>
 #include <iostream>
-#include <sys/stat.h>
 #include <vector>
 #include "REUtils.hpp"
 #include "StringUtils.hpp"
 #include "TypeRegistration.hpp"
 
-using std::cout;
-using std::endl;
 using std::string;
 using std::vector;
 
@@ -24,16 +22,16 @@ struct Resource {
     uint32_t fileOffset;
 };
 
-static void extract(const string &filename, const ByteArray &ba) {
-    upp::File file(filename.c_str(), O_CREAT|O_WRONLY|O_TRUNC);
-    file.write(ba.data(),ba.size());
-}
+static const TypeRegistration::Signature SIGNATURES[]={
+    // Version 5: encoding (0..2) and three bytes of padding follow the version
+    {"\x05\x00\x00\x00\x00\x00\x00\x00", "\xFF\xFF\xFF\xFF\xFC\xFF\xFF\xFF"},
+};
 
 static bool detect(BinaryReader &is, const string &filename) {
     return endsWith(filename, ".pak");
 }
 
-static void extract(BinaryReader &is, const string &outDir) {
+static void extract(BinaryReader &is, const Context &context) {
     uint32_t version=is.readIntLE();
     uint8_t encoding=0;
     uint16_t nResources=0, nAliases=0;
@@ -58,7 +56,7 @@ static void extract(BinaryReader &is, const string &outDir) {
         uint16_t resourceId=is.readShortLE();
         uint32_t fileOffset=is.readIntLE();
         
-        cout << "Entry #" << i << ": resource " << resourceId << endl;
+        console() << "Entry #" << i << ": resource " << resourceId << '\n';
         resources[i].resourceId=resourceId;
         resources[i].fileOffset=fileOffset;
     }
@@ -68,30 +66,41 @@ static void extract(BinaryReader &is, const string &outDir) {
         uint16_t resourceId=is.readShortLE();
         uint16_t entryIndex=is.readShortLE();
         
-        cout << "Alias #" << i << ": resource " << resourceId << endl;
+        console() << "Alias #" << i << ": resource " << resourceId << '\n';
     }
     
     // Finally, unpack the resources
-    mkdir(outDir.c_str(), 0700);
+    context.createDirectory();
     for (size_t i=0; i<resources.size(); i++) {
         uint16_t resourceId=resources[i].resourceId;
         uint32_t thisOffset=resources[i].fileOffset;
         uint32_t nextOffset=i==resources.size()-1?is.getSize():resources[i+1].fileOffset;
         uint32_t fileSize=nextOffset-thisOffset;
         
-        ByteArray ba=BinaryReader(is, thisOffset, fileSize).readAll();
+        if (!context.wantsId(resourceId))
+            continue;
+        
+        // The compression is known from the first bytes, so that listing
+        // gives the same names as unpacking
+        Span ba=is.span(thisOffset, std::min<size_t>(fileSize, 2));
         uint16_t compressionMagic=ba.size()<2?0:ba[0]|(ba[1]<<8);
         const char * extension="";
         if (compressionMagic==GZIP_MAGIC)
             extension=".gz";
         
-        string outFilename=outDir+'/'+std::to_string(resourceId)+extension;
-        cout << "Extracting " << outFilename << endl;
-        extract(outFilename, ba);
+        string name=std::to_string(resourceId)+extension;
+        if (!context.wants(name))
+            continue;
+        context.addEntry(name, BinaryReader(is, thisOffset, fileSize), *extension?"gzip":nullptr);
+        if (context.isListing())
+            continue;
+        string outFilename=context.getPath(name);
+        console() << "Extracting " << outFilename << '\n';
+        context.write(BinaryReader(is, thisOffset, fileSize), name);
     }
     
     // Create symbolic links for aliases
     // TODO
 }
 
-TR(chromium);
+TR_MAGIC(chromium);
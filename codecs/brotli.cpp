@@ -0,0 +1,58 @@
+/*******************************************************************************
+ *  Brotli decompression
+ ******************************************************************************/
+
+#ifdef WITH_BROTLI
+#include <brotli/decode.h>
+#include "../Codec.hpp"
+
+class BrotliDecoder : public Decoder {
+public:
+    explicit BrotliDecoder(Sink &output) : output(output),
+            state(BrotliDecoderCreateInstance(nullptr, nullptr, nullptr)),
+            buffer(256*1024), done(false) {
+        if (!state)
+            throw "BrotliDecoderCreateInstance()";
+    }
+    ~BrotliDecoder() {
+        BrotliDecoderDestroyInstance(state);
+    }
+    bool update(const void * data, size_t length) override {
+        const uint8_t * in=static_cast<const uint8_t *>(data);
+        
+        while (!done) {
+            uint8_t * out=&buffer[0];
+            size_t availableOut=buffer.size();
+            BrotliDecoderResult result=BrotliDecoderDecompressStream(state,
+                &length, &in, &availableOut, &out, nullptr);
+            if (availableOut<buffer.size())
+                output.write(&buffer[0], buffer.size()-availableOut);
+            
+            if (result==BROTLI_DECODER_RESULT_SUCCESS)
+                done=true;
+            else if (result==BROTLI_DECODER_RESULT_ERROR)
+                throw BrotliDecoderErrorString(BrotliDecoderGetErrorCode(state));
+            else if (result==BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT)
+                break;
+        }
+        
+        return done;
+    }
+    void finish() override {
+        if (!done)
+            throw "brotli stream is truncated";
+    }
+    
+private:
+    Sink &output;
+    BrotliDecoderState * state;
+    ByteArray buffer;
+    bool done;
+};
+
+static std::unique_ptr<Decoder> create(Sink &output) {
+    return std::make_unique<BrotliDecoder>(output);
+}
+
+CODEC_NOSNIFF(brotli);
+#endif
@@ -0,0 +1,15 @@
+/*******************************************************************************
+ *  gzip decompression
+ ******************************************************************************/
+
+#include "../Codec.hpp"
+
+static bool sniff(const uint8_t * data, size_t length) {
+    return (length>=2)&&(data[0]==0x1F)&&(data[1]==0x8B);
+}
+
+static std::unique_ptr<Decoder> create(Sink &output) {
+    return std::make_unique<Inflater>(output, 16+15);
+}
+
+CODEC(gzip);
@@ -0,0 +1,57 @@
+/*******************************************************************************
+ *  LZ4 frame decompression
+ ******************************************************************************/
+
+#ifdef WITH_LZ4
+#include <lz4frame.h>
+#include "../Codec.hpp"
+
+class LZ4Decoder : public Decoder {
+public:
+    explicit LZ4Decoder(Sink &output) : output(output), context(nullptr),
+            buffer(256*1024), pending(1) {
+        if (LZ4F_isError(LZ4F_createDecompressionContext(&context, LZ4F_VERSION)))
+            throw "LZ4F_createDecompressionContext()";
+    }
+    ~LZ4Decoder() {
+        LZ4F_freeDecompressionContext(context);
+    }
+    bool update(const void * data, size_t length) override {
+        const uint8_t * in=static_cast<const uint8_t *>(data);
+        
+        for (bool progress=true; progress&&pending;) {
+            size_t inSize=length, outSize=buffer.size();
+            pending=LZ4F_decompress(context, &buffer[0], &outSize, in, &inSize, nullptr);
+            if (LZ4F_isError(pending))
+                throw LZ4F_getErrorName(pending);
+            if (outSize)
+                output.write(&buffer[0], outSize);
+            in+=inSize;
+            length-=inSize;
+            progress=inSize||outSize;
+        }
+        
+        return pending==0;
+    }
+    void finish() override {
+        if (pending)
+            throw "lz4 stream is truncated";
+    }
+    
+private:
+    Sink &output;
+    LZ4F_dctx * context;
+    ByteArray buffer;
+    size_t pending;
+};
+
+static bool sniff(const uint8_t * data, size_t length) {
+    return (length>=4)&&(data[0]==0x04)&&(data[1]==0x22)&&(data[2]==0x4D)&&(data[3]==0x18);
+}
+
+static std::unique_ptr<Decoder> create(Sink &output) {
+    return std::make_unique<LZ4Decoder>(output);
+}
+
+CODEC(lz4);
+#endif
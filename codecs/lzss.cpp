@@ -0,0 +1,83 @@
+/*******************************************************************************
+ *  LZSS decompression (4K window, 12-bit offsets, 4-bit lengths), as used in
+ *  Haier firmwares
+ ******************************************************************************/
+
+#include "../Codec.hpp"
+
+class LZSSDecoder : public Decoder {
+public:
+    explicit LZSSDecoder(Sink &output) : output(output), flags(0), ready(false),
+        first(-1), total(0) {}
+    bool update(const void * data, size_t length) override {
+        const uint8_t * in=static_cast<const uint8_t *>(data);
+        
+        for (size_t inPos=0; inPos<length; inPos++) {
+            uint8_t c=in[inPos];
+            
+            if (first>=0) {
+                // Second byte of a dictionary reference
+                uint8_t count=(first>>4)+3;
+                uint16_t offset=((first&0x0F)<<8)|c;
+                first=-1;
+                while (count--)
+                    put((offset&&offset<=total)?window[(total-offset)%WINDOW_SIZE]:0);
+                continue;
+            }
+            
+            if (!ready) {
+                flags>>=1;
+                ready=true;
+                if (!(flags&0x100)) {
+                    // get next flags
+                    flags=0xFF00|c;
+                    continue;
+                }
+            }
+            
+            ready=false;
+            if (flags&1)
+                put(c); // plain byte
+            else
+                first=c; // dictionary bytes
+        }
+        
+        return false;
+    }
+    void finish() override {
+        flush();
+    }
+    
+private:
+    static const size_t WINDOW_SIZE=4096;
+    static const size_t BUFFER_SIZE=64*1024;
+    
+    void put(uint8_t c) {
+        window[total%WINDOW_SIZE]=c;
+        total++;
+        buffer.push_back(c);
+        if (buffer.size()>=BUFFER_SIZE)
+            flush();
+    }
+    void flush() {
+        if (!buffer.empty())
+            output.write(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+    
+    Sink &output;
+    uint16_t flags;
+    /** Whether `flags` are already shifted for the next item **/
+    bool ready;
+    /** First byte of a dictionary reference, or -1 **/
+    int first;
+    uint64_t total;
+    uint8_t window[WINDOW_SIZE];
+    ByteArray buffer;
+};
+
+static std::unique_ptr<Decoder> create(Sink &output) {
+    return std::make_unique<LZSSDecoder>(output);
+}
+
+CODEC_NOSNIFF(lzss);
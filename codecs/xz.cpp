@@ -0,0 +1,68 @@
+/*******************************************************************************
+ *  xz/lzma decompression
+ ******************************************************************************/
+
+#ifdef WITH_XZ
+#include <cstring>
+#include <lzma.h>
+#include "../Codec.hpp"
+
+class XZDecoder : public Decoder {
+public:
+    explicit XZDecoder(Sink &output) : output(output), stream(LZMA_STREAM_INIT),
+            buffer(256*1024), done(false) {
+        if (lzma_auto_decoder(&stream, UINT64_MAX, LZMA_CONCATENATED)!=LZMA_OK)
+            throw "lzma_auto_decoder()";
+    }
+    ~XZDecoder() {
+        lzma_end(&stream);
+    }
+    bool update(const void * data, size_t length) override {
+        stream.next_in=static_cast<const uint8_t *>(data);
+        stream.avail_in=length;
+        return run(LZMA_RUN);
+    }
+    void finish() override {
+        // LZMA_CONCATENATED needs LZMA_FINISH to report the end of the stream
+        if (!run(LZMA_FINISH))
+            throw "xz stream is truncated";
+    }
+    
+private:
+    bool run(lzma_action action) {
+        while (!done) {
+            stream.next_out=&buffer[0];
+            stream.avail_out=buffer.size();
+            lzma_ret retval=lzma_code(&stream, action);
+            if (stream.avail_out<buffer.size())
+                output.write(&buffer[0], buffer.size()-stream.avail_out);
+            
+            if (retval==LZMA_STREAM_END)
+                done=true;
+            else if (retval==LZMA_BUF_ERROR)
+                break;
+            else if (retval!=LZMA_OK)
+                throw "xz stream is corrupted";
+            else if ((stream.avail_in==0)&&(stream.avail_out>0)&&(action==LZMA_RUN))
+                break;
+        }
+        return done;
+    }
+    
+    Sink &output;
+    lzma_stream stream;
+    ByteArray buffer;
+    bool done;
+};
+
+static bool sniff(const uint8_t * data, size_t length) {
+    static const uint8_t MAGIC[]={0xFD, '7', 'z', 'X', 'Z', 0x00};
+    return (length>=sizeof(MAGIC))&&!memcmp(data, MAGIC, sizeof(MAGIC));
+}
+
+static std::unique_ptr<Decoder> create(Sink &output) {
+    return std::make_unique<XZDecoder>(output);
+}
+
+CODEC(xz);
+#endif
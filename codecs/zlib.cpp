@@ -0,0 +1,17 @@
+/*******************************************************************************
+ *  zlib and raw deflate decompression
+ ******************************************************************************/
+
+#include "../Codec.hpp"
+
+static bool sniff(const uint8_t * data, size_t length) {
+    // CMF: deflate with a window of up to 32K, FCHECK makes CMF.FLG divisible by 31
+    return (length>=2)&&((data[0]&0x0F)==8)&&((data[0]>>4)<=7)&&
+        ((data[0]<<8|data[1])%31==0);
+}
+
+static std::unique_ptr<Decoder> create(Sink &output) {
+    return std::make_unique<Inflater>(output, 15);
+}
+
+CODEC(zlib);
@@ -0,0 +1,65 @@
+/*******************************************************************************
+ *  Zstandard decompression
+ ******************************************************************************/
+
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#include "../Codec.hpp"
+
+class ZstdDecoder : public Decoder {
+public:
+    explicit ZstdDecoder(Sink &output) : output(output), stream(ZSTD_createDStream()),
+            buffer(ZSTD_DStreamOutSize()), pending(1) {
+        if (!stream)
+            throw "ZSTD_createDStream()";
+    }
+    ~ZstdDecoder() {
+        ZSTD_freeDStream(stream);
+    }
+    bool update(const void * data, size_t length) override {
+        ZSTD_inBuffer in={data, length, 0};
+        
+        while (in.pos<in.size) {
+            ZSTD_outBuffer out={&buffer[0], buffer.size(), 0};
+            pending=ZSTD_decompressStream(stream, &out, &in);
+            if (ZSTD_isError(pending))
+                throw ZSTD_getErrorName(pending);
+            if (out.pos)
+                output.write(&buffer[0], out.pos);
+        }
+        
+        // Drain the data buffered inside the decoder
+        for (bool full=true; full;) {
+            ZSTD_outBuffer out={&buffer[0], buffer.size(), 0};
+            pending=ZSTD_decompressStream(stream, &out, &in);
+            if (ZSTD_isError(pending))
+                throw ZSTD_getErrorName(pending);
+            if (out.pos)
+                output.write(&buffer[0], out.pos);
+            full=out.pos==out.size;
+        }
+        
+        return pending==0;
+    }
+    void finish() override {
+        if (pending)
+            throw "zstd stream is truncated";
+    }
+    
+private:
+    Sink &output;
+    ZSTD_DStream * stream;
+    ByteArray buffer;
+    size_t pending;
+};
+
+static bool sniff(const uint8_t * data, size_t length) {
+    return (length>=4)&&(data[0]==0x28)&&(data[1]==0xB5)&&(data[2]==0x2F)&&(data[3]==0xFD);
+}
+
+static std::unique_ptr<Decoder> create(Sink &output) {
+    return std::make_unique<ZstdDecoder>(output);
+}
+
+CODEC(zstd);
+#endif
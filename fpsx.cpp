@@ -1,11 +1,15 @@
+#include <cstdio>
 #include <iostream>
+#include <map>
+#include <set>
 #include <unix++/FileSystem.hpp>
+#include "Record.hpp"
 #include "REUtils.hpp"
+#include "Statistics.hpp"
 #include "StringUtils.hpp"
+#include "Trace.hpp"
 #include "TypeRegistration.hpp"
 
-using std::cout;
-using std::endl;
 using std::string;
 using upp::File;
 
@@ -58,7 +62,171 @@ static const Property PROPERTIES[]={
     {250, "UNKFA_IMPL",                 false,  0}
 };
 
-static void extractFirmware(BinaryReader &is, const string &path, Indent indent);
+/** Common part of all block headers **/
+struct BlockHeader {
+    uint8_t ctype;
+    uint8_t unknown0;
+    uint8_t btype;
+    uint8_t headerSize;
+};
+
+using BlockHeaderLayout=Layout<BlockHeader, LE<&BlockHeader::ctype>,
+    LE<&BlockHeader::unknown0>, LE<&BlockHeader::btype>, LE<&BlockHeader::headerSize>>;
+
+struct BinaryBlock {
+    uint8_t memType;
+    uint16_t unknown1;
+    uint16_t checksum;
+    uint8_t padding;
+    uint32_t length;
+    uint32_t offset;
+    uint8_t unknown2;
+};
+
+using BinaryBlockLayout=Layout<BinaryBlock, LE<&BinaryBlock::memType>,
+    BE<&BinaryBlock::unknown1>, BE<&BinaryBlock::checksum>, LE<&BinaryBlock::padding>,
+    BE<&BinaryBlock::length>, BE<&BinaryBlock::offset>, LE<&BinaryBlock::unknown2>>;
+
+struct RofsHashBlock {
+    string sha1;
+    string description;
+    uint8_t memType;
+    uint16_t unknown;
+    uint16_t checksum;
+    uint32_t length;
+    uint32_t offset;
+    uint8_t unknown2;
+};
+
+using RofsHashBlockLayout=Layout<RofsHashBlock, String<&RofsHashBlock::sha1, 20>,
+    String<&RofsHashBlock::description, 12>, LE<&RofsHashBlock::memType>,
+    BE<&RofsHashBlock::unknown>, BE<&RofsHashBlock::checksum>,
+    BE<&RofsHashBlock::length>, BE<&RofsHashBlock::offset>, LE<&RofsHashBlock::unknown2>>;
+
+struct CoreCertBlock {
+    string sha1;
+    string description;
+    uint8_t memType;
+    uint16_t unknown;
+    uint16_t checksum;
+    uint32_t length;
+    uint32_t offset;
+    string sha12;
+    uint16_t unknown2;
+    uint8_t unknown3;
+};
+
+using CoreCertBlockLayout=Layout<CoreCertBlock, String<&CoreCertBlock::sha1, 20>,
+    String<&CoreCertBlock::description, 12>, LE<&CoreCertBlock::memType>,
+    BE<&CoreCertBlock::unknown>, BE<&CoreCertBlock::checksum>,
+    BE<&CoreCertBlock::length>, BE<&CoreCertBlock::offset>,
+    String<&CoreCertBlock::sha12, 20>, BE<&CoreCertBlock::unknown2>,
+    LE<&CoreCertBlock::unknown3>>;
+
+struct H2EBlock {
+    uint8_t memType;
+    uint8_t unknown[4];
+    string description;
+    uint32_t length;
+    uint32_t offset;
+    uint8_t unknown2;
+};
+
+using H2EBlockLayout=Layout<H2EBlock, LE<&H2EBlock::memType>, LE<&H2EBlock::unknown>,
+    String<&H2EBlock::description, 12>, BE<&H2EBlock::length>, BE<&H2EBlock::offset>,
+    LE<&H2EBlock::unknown2>>;
+
+struct H3ABlock {
+    uint8_t memType;
+    uint16_t unknown;
+    uint16_t checksum;
+    string description;
+};
+
+using H3ABlockLayout=Layout<H3ABlock, LE<&H3ABlock::memType>, BE<&H3ABlock::unknown>,
+    BE<&H3ABlock::checksum>, String<&H3ABlock::description, 12>>;
+
+/** Images made of the data of the blocks. They are written block by block,
+    also to an Output which takes pieces at offsets, or assembled in memory
+    and offered for unpacking with --recursive **/
+class Images {
+public:
+    explicit Images(const Context &context) : context(context), assemble(getRecursionDepth()>0) {}
+    /** Place the next `length` bytes of `is`, the data of a block of `type`,
+        at `offset` of the image `name` **/
+    void add(BinaryReader &is, uint8_t type, const string &name, off_t offset, size_t length) {
+        if (!context.wantsId(type)||!(context.wants(name)||(assemble&&context.wantsDirectory(name+".d")))) {
+            is.skip(length);
+            return;
+        }
+        
+        // The data of the block is placed at `offset` of the image. An
+        // assembled image is only reported as a file if it is not unpacked
+        BinaryReader data(is, is.tell(), length);
+        is.skip(length);
+        bool writing=!assemble&&!context.isListing();
+        BlockSink * sink=writing&&context.getOutput()?getSink(name):nullptr;
+        if (assemble||(writing&&context.getOutput()&&!sink)) {
+            Image &image=images[name];
+            if (!image.source)
+                image.source=std::make_shared<SegmentedSource>();
+            image.source->add(offset, data);
+            image.blocks.push_back(data);
+            return;
+        }
+        context.addEntry(name, data, "blocks");
+        if (sink)
+            data.extract(*sink, offset, length);
+        else if (writing) {
+            // The image is counted, and the runs of erased flash of the
+            // previous run are dropped, with its first block
+            if (opened.insert(name).second) {
+                count(Statistics::FILES);
+                resetErasedRuns(context.getPath(name));
+            }
+            data.extract(context.getPath(name), offset, length);
+        }
+    }
+    const Context &getContext() const { return context; }
+    /** Unpack or write the assembled images, finish the others **/
+    void finish() {
+        sinks.clear();
+        for (auto i=images.begin(); i!=images.end(); ++i) {
+            BinaryReader image(i->second.source);
+            if (TypeRegistration::offer(image, context, i->first))
+                continue;
+            for (auto j=i->second.blocks.begin(); j!=i->second.blocks.end(); ++j)
+                context.addEntry(i->first, *j, "blocks");
+            if (!context.isListing()&&context.wants(i->first))
+                context.write(image, i->first);
+        }
+    }
+    
+private:
+    /** Image to be assembled and the blocks it is made of **/
+    struct Image {
+        std::shared_ptr<SegmentedSource> source;
+        std::vector<BinaryReader> blocks;
+    };
+    
+    /** Sink of the image `name` in the Output, nullptr if the Output only
+        takes whole files, so that the image has to be assembled **/
+    BlockSink * getSink(const string &name) {
+        auto i=sinks.find(name);
+        if (i==sinks.end())
+            i=sinks.emplace(name, context.createBlocks(name)).first;
+        return i->second.get();
+    }
+    
+    const Context &context;
+    bool assemble;
+    std::map<string, Image> images;
+    std::map<string, std::unique_ptr<BlockSink>> sinks;
+    /** Images written to files so far **/
+    std::set<string> opened;
+};
+
+static void extractFirmware(BinaryReader &is, const Context &context, Indent indent);
 
 static const Property &getProperty(uint8_t key) {
     static const Property DEFAULT={0, nullptr, false, 0};
@@ -68,7 +236,7 @@ static const Property &getProperty(uint8_t key) {
     return DEFAULT;
 }
 
-static void dumpTLV(BinaryReader &is, const string &path, Indent indent) {
+static void dumpTLV(BinaryReader &is, const Context &context, Indent indent) {
     uint32_t nProperties=is.readInt();
     for (uint32_t i=0; i<nProperties; i++) {
         uint8_t key=is.readByte();
@@ -77,152 +245,127 @@ static void dumpTLV(BinaryReader &is, const string &path, Indent indent) {
         size_t length=property.large?is.readShort():is.readByte();
         string value=is.readString(length);
         
-        cout << indent << "Property " << Hex<>(key);
+        console() << indent << "Property " << Hex<>(key);
         if (property.name)
-            cout << ' ' << property.name;
-        cout << ": ";
+            console() << ' ' << property.name;
+        console() << ": ";
         
         if (value.empty()) {
             if (key==0xfa) {
-                cout << endl;
+                console() << '\n';
                 BinaryReader iis=is.window(is.readInt());
                 //iis.extract(path+"/toolbox.0");
-                extractFirmware(iis, path+"/toolbox", indent);
+                extractFirmware(iis, Context(context, "toolbox"), indent);
                 continue;
             }
             else
-                cout << is.readInt();
+                console() << is.readInt();
         }
         else if (property.presentation==1) {
-            cout << value;
+            console() << value;
         }
-        else if (property.presentation==2) {
-            string filename=path+"/property"+std::to_string(key);
-            File fout(filename.c_str(), O_WRONLY|O_TRUNC|O_CREAT);
-            fout.write(&value[0], value.size());
-            cout << "saved to " << filename;
+        else if ((property.presentation==2)&&!context.isListing()) {
+            string name="property"+std::to_string(key);
+            auto sink=context.create(name);
+            if (sink)
+                sink->write(&value[0], value.size());
+            console() << "saved to " << context.getPath(name);
         }
         else if (property.presentation==3) {
             // TODO: nested TLV block
-            cout << toHexString(value);
+            console() << toHexString(value);
         }
         else
-            cout << toHexString(value);
+            console() << toHexString(value);
         
-        cout << endl;
+        console() << '\n';
     }
 }
 
-static void dumpBlock(BinaryReader &is, const string &path, Indent indent) {
-    uint8_t ctype=is.readByte();
-    uint8_t unknown0=is.readByte();
-    uint8_t btype=is.readByte();
-    uint8_t headerSize=is.readByte();
+static void dumpBlock(BinaryReader &is, Images &images, Indent indent) {
+    off_t position=is.debug();
+    BlockHeader header=is.readRecord<BlockHeaderLayout>();
     
-    cout << indent << "!" << Hex<>(is.debug()) << endl;
-    cout << indent << "CType: " << Hex<>(ctype) << endl;
-    cout << indent << "Padding: " << Hex<>(unknown0) << endl;
-    cout << indent << "Type: " << Hex<>(btype) << endl;
-    cout << indent << "HeaderSize: " << unsigned(headerSize) << endl;
+    console() << indent << "!" << Hex<>(position+4) << '\n';
+    console() << indent << "CType: " << Hex<>(header.ctype) << '\n';
+    console() << indent << "Padding: " << Hex<>(header.unknown0) << '\n';
+    console() << indent << "Type: " << Hex<>(header.btype) << '\n';
+    console() << indent << "HeaderSize: " << unsigned(header.headerSize) << '\n';
     
-    BinaryReader wis=is.window(headerSize);
+    BinaryReader wis=is.window(header.headerSize);
     is.readByte();
     
-    if (btype==BLOCK_TYPE_BINARY) {
-        uint8_t memType=wis.readByte();
-        uint16_t unknown1=wis.readShort();
-        uint32_t checksum=wis.readShort();
-        uint8_t padding=wis.readByte();
-        uint32_t length=wis.readInt();
-        uint32_t offset=wis.readInt();
-        uint8_t unknown2=wis.readByte();
+    char type[8];
+    snprintf(type, sizeof(type), "0x%02X", header.btype);
+    images.getContext().addBlock(type, position, is.debug()-position);
+    TraceSpan span("block", type, position, is.debug()-position);
+    
+    if (header.btype==BLOCK_TYPE_BINARY) {
+        BinaryBlock block=wis.readRecord<BinaryBlockLayout>();
         
-        cout << indent << "MemType: " << Hex<>(memType) << endl;
-        cout << indent << "Unknown1: " << unknown1 << endl;
-        cout << indent << "Checksum: " << checksum << endl;
-        cout << indent << "Data block: " << offset << ":" << length << endl;
-        cout << indent << "Unknown2: " << unsigned(unknown2) << endl;
+        console() << indent << "MemType: " << Hex<>(block.memType) << '\n';
+        console() << indent << "Unknown1: " << block.unknown1 << '\n';
+        console() << indent << "Checksum: " << block.checksum << '\n';
+        console() << indent << "Data block: " << block.offset << ":" << block.length << '\n';
+        console() << indent << "Unknown2: " << unsigned(block.unknown2) << '\n';
         
-        is.extract(path+"/rofs.img", offset, length);
+        images.add(is, header.btype, "rofs.img", block.offset, block.length);
     }
-    else if (btype==BLOCK_TYPE_ROFS_HASH) {
+    else if (header.btype==BLOCK_TYPE_ROFS_HASH) {
         // Toolbox?
-        string sha1=wis.readString(20);
-        string description=wis.readString(12);
-        uint8_t memType=wis.readByte();
-        uint16_t unknown=wis.readShort();
-        uint16_t checksum=wis.readShort();
-        uint32_t length=wis.readInt();
-        uint32_t offset=wis.readInt();
-        uint8_t unknown2=wis.readByte();
+        RofsHashBlock block=wis.readRecord<RofsHashBlockLayout>();
         
-        cout << indent << "Description: " << description << endl;
-        cout << indent << "MemType: " << Hex<>(memType) << endl;
-        cout << indent << "Unknown: " << unknown << endl;
-        cout << indent << "Checksum: " << checksum << endl;
-        cout << indent << "Data block: " << offset << ":" << length << endl;
-        cout << indent << "Unknown2: " << unsigned(unknown2) << endl;
+        console() << indent << "Description: " << block.description << '\n';
+        console() << indent << "MemType: " << Hex<>(block.memType) << '\n';
+        console() << indent << "Unknown: " << block.unknown << '\n';
+        console() << indent << "Checksum: " << block.checksum << '\n';
+        console() << indent << "Data block: " << block.offset << ":" << block.length << '\n';
+        console() << indent << "Unknown2: " << unsigned(block.unknown2) << '\n';
         
-        is.extract(path+"/rofs.img", offset, length);
+        images.add(is, header.btype, "rofs.img", block.offset, block.length);
     }
-    else if (btype==BLOCK_TYPE_CORE_CERT) {
+    else if (header.btype==BLOCK_TYPE_CORE_CERT) {
         // Certificate
-        string sha1=wis.readString(20);
-        string description=wis.readString(12);
-        uint8_t memType=wis.readByte();
-        uint16_t unknown=wis.readShort();
-        uint16_t checksum=wis.readShort();
-        uint32_t length=wis.readInt();
-        uint32_t offset=wis.readInt();
-        string sha12=wis.readString(20);
-        uint16_t unknown2=wis.readShort();
-        uint8_t unknown3=wis.readByte();
+        CoreCertBlock block=wis.readRecord<CoreCertBlockLayout>();
         
-        cout << indent << "Description: " << description << endl;
-        cout << indent << "MemType: " << Hex<>(memType) << endl;
-        cout << indent << "Unknown: " << unknown << endl;
-        cout << indent << "Checksum: " << checksum << endl;
-        cout << indent << "Data block: " << offset << ":" << length << endl;
-        cout << indent << "Unknown2: " << unknown2 << endl;
-        cout << indent << "Unknown3: " << unsigned(unknown3) << endl;
+        console() << indent << "Description: " << block.description << '\n';
+        console() << indent << "MemType: " << Hex<>(block.memType) << '\n';
+        console() << indent << "Unknown: " << block.unknown << '\n';
+        console() << indent << "Checksum: " << block.checksum << '\n';
+        console() << indent << "Data block: " << block.offset << ":" << block.length << '\n';
+        console() << indent << "Unknown2: " << block.unknown2 << '\n';
+        console() << indent << "Unknown3: " << unsigned(block.unknown3) << '\n';
         
-        if ((int)offset==-1)
-            is.extract(path+"/"+description+".img", 0, length);
+        if ((int)block.offset==-1)
+            images.add(is, header.btype, block.description+".img", 0, block.length);
         else
-            is.extract(path+"/rofs.img", offset, length);
+            images.add(is, header.btype, "rofs.img", block.offset, block.length);
     }
-    else if (btype==BLOCK_TYPE_H2E) {
-        uint8_t memType=wis.readByte();
+    else if (header.btype==BLOCK_TYPE_H2E) {
+        H2EBlock block=wis.readRecord<H2EBlockLayout>();
         for (unsigned i=0; i<4; i++)
-            cout << indent << "Unknown[" << i << "]: " << Hex<>(wis.readByte()) << endl;
-        string description=wis.readString(12);
-        uint32_t length=wis.readInt();
-        uint32_t offset=wis.readInt();
-        uint8_t unknown=wis.readByte();
+            console() << indent << "Unknown[" << i << "]: " << Hex<>(block.unknown[i]) << '\n';
         
-        cout << indent << "MemType: " << Hex<>(memType) << endl;
-        cout << indent << "Description: " << description << endl;
-        cout << indent << "Length: " << length << endl;
-        cout << indent << "Offset: " << offset << endl;
-        cout << indent << "Unknown: " << unsigned(unknown) << endl;
+        console() << indent << "MemType: " << Hex<>(block.memType) << '\n';
+        console() << indent << "Description: " << block.description << '\n';
+        console() << indent << "Length: " << block.length << '\n';
+        console() << indent << "Offset: " << block.offset << '\n';
+        console() << indent << "Unknown: " << unsigned(block.unknown2) << '\n';
         
-        is.extract(path+'/'+"userarea.img", offset, length);
+        images.add(is, header.btype, "userarea.img", block.offset, block.length);
     }
-    else if (btype==BLOCK_TYPE_H30) {
+    else if (header.btype==BLOCK_TYPE_H30) {
         throw "BLOCK_TYPE_H30 is not supported yet";
     }
-    else if (btype==BLOCK_TYPE_H3A) {
-        uint8_t memType=wis.readByte();
-        uint16_t unknown=wis.readShort();
-        uint16_t checksum=wis.readShort();
-        string description=wis.readString(12);
+    else if (header.btype==BLOCK_TYPE_H3A) {
+        H3ABlock block=wis.readRecord<H3ABlockLayout>();
         
-        cout << indent << "MemType: " << Hex<>(memType) << endl;
-        cout << indent << "Unknown: " << unsigned(unknown) << endl;
-        cout << indent << "Checksum: " << checksum << endl;
-        cout << indent << "Description: " << description << endl;
+        console() << indent << "MemType: " << Hex<>(block.memType) << '\n';
+        console() << indent << "Unknown: " << unsigned(block.unknown) << '\n';
+        console() << indent << "Checksum: " << block.checksum << '\n';
+        console() << indent << "Description: " << block.description << '\n';
     }
-    else if (btype==BLOCK_TYPE_H49) {
+    else if (header.btype==BLOCK_TYPE_H49) {
         throw "BLOCK_TYPE_H49 is not supported yet";
     }
     else {
@@ -230,37 +373,40 @@ static void dumpBlock(BinaryReader &is, const string &path, Indent indent) {
     }
     
     if (!wis.atEnd())
-        cout << indent << "Block header was not fully read" << endl;
+        console() << indent << "Block header was not fully read" << '\n';
 }
 
 static bool detect(BinaryReader &is, const string &filename) {
     return endsWith(filename, ".fpsx");
 }
 
-static void extractFirmware(BinaryReader &is, const string &path, Indent indent) {
+static void extractFirmware(BinaryReader &is, const Context &context, Indent indent) {
+    TraceSpan span("firmware", context.getOutputDir(), is.debug(), is.available());
     uint8_t signature=is.readByte();
     uint32_t headerSize=is.readInt();
     
-    mkdir(path.c_str(), 0700);
+    context.createDirectory();
     
-    cout << indent << "Magic: " << unsigned(signature) << endl;
-    cout << indent << "Header size: " << headerSize << endl;
+    console() << indent << "Magic: " << unsigned(signature) << '\n';
+    console() << indent << "Header size: " << headerSize << '\n';
     
     // Header
     BinaryReader wis=is.window(headerSize);
-    dumpTLV(wis, path, indent);
+    dumpTLV(wis, context, indent);
     if (!wis.atEnd())
-        cout << "Header is not fully read (@" << Hex<unsigned>(wis.tell()) << ")" << endl;
+        console() << "Header is not fully read (@" << Hex<unsigned>(wis.tell()) << ")" << '\n';
     
     // Blocks
+    Images images(context);
     for (unsigned i=0; !is.atEnd(); i++) {
-        cout << indent << "Block #" << i << ": " << endl;
-        dumpBlock(is, path, indent);
+        console() << indent << "Block #" << i << ": " << '\n';
+        dumpBlock(is, images, indent);
     }
+    images.finish();
 }
 
-static void extract(BinaryReader &is, const string &path) {
-    return extractFirmware(is, path, Indent());
+static void extract(BinaryReader &is, const Context &context) {
+    return extractFirmware(is, context, Indent());
 }
 
 TR(fpsx);
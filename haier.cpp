@@ -5,51 +5,14 @@
  ******************************************************************************/
 
 #include <iostream>
+#include "Codec.hpp"
 #include "REUtils.hpp"
 #include "TypeRegistration.hpp"
 
-using std::cout;
-using std::endl;
 using std::string;
 using std::vector;
 
-static ByteArray decompressLZSS(const ByteArray &in) {
-    ByteArray result;
-    uint16_t flags=0;
-    size_t inPos=0;
-    
-    while (inPos<in.size()) {
-        flags>>=1;
-        
-        if (!(flags&0x100)) {
-            // get next flags
-            flags=0xFF00|in[inPos++];
-        }
-        
-        if (flags&1) {
-            // plain byte
-            uint8_t c=in[inPos++];
-            result.push_back(c);
-        }
-        else {
-            // dictionary bytes
-            uint8_t x=in[inPos++];
-            uint8_t count=(x>>4)+3;
-            uint16_t offset=((x&0x0F)<<8)|in[inPos++];
-            
-            while (count--) {
-                if (size_t(offset)>result.size())
-                    result.push_back(0);
-                else
-                    result.push_back(result[result.size()-offset]);
-            }
-        }
-    }
-    
-    return result;
-}
-
-static void extract(BinaryReader &is, const string &outDir) {
+static void extract(BinaryReader &is, const Context &context) {
     vector<off_t> segments;
     
     try {
@@ -65,20 +28,27 @@ static void extract(BinaryReader &is, const string &outDir) {
     }
     catch (EOFException &e) {}
     
+    context.createDirectory();
     for (size_t i=0; i<segments.size(); i++) {
-        cout << "Segment at " << Hex(segments[i]) << endl;
+        console() << "Segment at " << Hex(segments[i]) << '\n';
         BinaryReader window(is, segments[i], BinaryReader::END);
         uint32_t magic=window.readInt();
         uint32_t unknown=window.readInt();
         uint32_t length=window.readInt();
-        cout << "    Unknown: " << Hex(unknown) << endl;
-        cout << "    Length: " << length << endl;
-        ByteArray compressedData=window.read(length);
-        ByteArray data=decompressLZSS(compressedData);
+        console() << "    Unknown: " << Hex(unknown) << '\n';
+        console() << "    Length: " << length << '\n';
+        size_t compressedLength=std::min<size_t>(length, window.available());
+        
+        string name="seg_"+std::to_string(i)+".seg";
+        BinaryReader compressed(window, window.tell(), compressedLength);
+        context.addEntry(name, compressed, "lzss");
+        if (context.isListing()||!context.wants(name))
+            continue;
         
-        string filename=outDir+'/'+"seg_"+std::to_string(i)+".seg";
-        upp::File out(filename.c_str(), O_WRONLY|O_CREAT|O_TRUNC);
-        out.write(data.data(), data.size());
+        Span compressedData=window.span(window.tell(), compressedLength);
+        auto sink=context.create(name, compressed);
+        if (sink)
+            decode("lzss", compressedData.data(), compressedData.size(), *sink);
     }
 }
 
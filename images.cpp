@@ -9,14 +9,12 @@
 #include "REUtils.hpp"
 #include "TypeRegistration.hpp"
 
-using std::cout;
-using std::endl;
 using std::string;
 using upp::File;
 
 class StreamReader {
 public:
-    StreamReader(const ByteArray &ba, size_t offset) :
+    StreamReader(const Span &ba, size_t offset) :
         ba(ba), offset(offset) {}
     uint8_t getByte() {
         if (offset>=ba.size())
@@ -42,11 +40,11 @@ public:
     size_t getOffset() const { return offset; }
     
 private:
-    const ByteArray &ba;
+    const Span &ba;
     size_t offset;
 };
 
-static size_t detectJPEG(const ByteArray &data, size_t offset) {
+static size_t detectJPEG(const Span &data, size_t offset) {
     try {
         StreamReader sr(data, offset);
         
@@ -120,7 +118,7 @@ static size_t detectJPEG(const ByteArray &data, size_t offset) {
                     state=START;
                     break;
                 default:
-                    cout << "[JPEG] unknown chunk " << std::hex << unsigned(byte) << endl;
+                    console() << "[JPEG] unknown chunk " << std::hex << unsigned(byte) << '\n';
                     end=true;
                 }
             }
@@ -137,20 +135,27 @@ static size_t detectJPEG(const ByteArray &data, size_t offset) {
     }
 }
 
-static void extract(BinaryReader &is, const string &outDir) {
-    ByteArray data=is.readAll();
+static void extract(BinaryReader &is, const Context &context) {
+    Span data=is.span(is.tell(), is.available());
+    context.createDirectory();
     
     for (size_t offset=0; offset<data.size(); offset++) {
         size_t length=detectJPEG(data, offset);
         if (length!=string::npos) {
-            cout << "[JPEG] found at " << offset << endl;
+            console() << "[JPEG] found at " << offset << '\n';
             
             char buffer[32];
             snprintf(buffer, sizeof(buffer), "0x%06zX", offset);
             
-            string filename=outDir+'/'+buffer+".jpeg";
-            File outFile(filename.c_str(), O_WRONLY|O_TRUNC|O_CREAT);
-            outFile.write(&data[offset], length);
+            string name=string(buffer)+".jpeg";
+            BinaryReader image(is, is.tell()+offset, length);
+            context.addEntry(name, image);
+            if (context.isListing()||!context.wants(name))
+                continue;
+            
+            auto sink=context.create(name, image);
+            if (sink)
+                sink->write(data.data()+offset, length);
         }
     }
 }
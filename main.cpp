@@ -4,11 +4,31 @@
  *  © 2020—2024, Sauron
  ******************************************************************************/
 
+#include <atomic>
+#include <chrono>
+#include <fstream>
 #include <cstring>
+#include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "AsyncIO.hpp"
+#include "Incremental.hpp"
+#include "Index.hpp"
+#include "IndexCache.hpp"
+#include "Mount.hpp"
+#include "Progress.hpp"
 #include "REUtils.hpp"
+#include "Statistics.hpp"
+#include "Store.hpp"
 #include "StringUtils.hpp"
+#include "Trace.hpp"
 #include "TypeRegistration.hpp"
+#include "Unpacker.hpp"
 
 using namespace upp;
 using std::cerr;
@@ -17,19 +37,255 @@ using std::endl;
 using std::string;
 using std::vector;
 
-extern void extractAndroidImage(BinaryReader &is, const string &filename);
-extern void extractChromiumPackage(BinaryReader &is, const string &outDir);
-extern void extractFirmware(BinaryReader &is, const string &outDir, Indent indent=Indent());
-extern void extractSymbianImage(BinaryReader &is, const string &outDir, Indent indent=Indent());
-extern void extract5500FileSystem(BinaryReader &is, const string &outDir, Indent indent=Indent());
+
+/** Options shared by all input files **/
+struct Options {
+    string output=".";
+    string type;
+    BinaryReader::Backend backend=BinaryReader::MMAP;
+    size_t blockSize=BinaryReader::DEFAULT_BLOCK_SIZE;
+    bool listing=false;
+    /** Events of all files as NDJSON, if requested **/
+    std::shared_ptr<EventSink> events;
+    /** Whether the events go to the standard output instead of the log **/
+    bool eventsToStdout=false;
+    /** Path of a single file to print instead of unpacking **/
+    string cat;
+    /** Directory to mount the input at instead of unpacking **/
+    string mountPoint;
+    /** Content-addressed store for the unpacked files, if it is used **/
+    string store;
+    /** Whether the files unchanged since the previous run are skipped **/
+    bool incremental=false;
+    /** Descriptor to report the progress on, -1 if it is not reported **/
+    int progress=-1;
+    /** Whether statistics are printed at exit, and whether as JSON **/
+    bool stats=false;
+    bool statsJSON=false;
+    /** Saved indexes of the inputs, if they are used **/
+    std::shared_ptr<IndexCache> indexCache;
+    std::shared_ptr<Filter> filter;
+};
+
+/** Filter of the options, created when the first condition is added **/
+static Filter &filter(Options &options) {
+    if (!options.filter)
+        options.filter=std::make_shared<Filter>();
+    return *options.filter;
+}
+
+/** Result of processing a single input file **/
+struct Job {
+    const char * filename;
+    bool succeeded=false;
+    double seconds=0;
+    string error;
+    /** Counters and times, if they are collected **/
+    std::shared_ptr<Statistics> statistics;
+};
+
+/** Index of the file, loaded from the cache if it is used **/
+static std::unique_ptr<Index> openIndex(File &file, const BinaryReader &is, const char * filename,
+        const Options &options) {
+    Unpacker unpacker;
+    unpacker.setType(options.type);
+    if (options.indexCache)
+        return options.indexCache->get(file, is, filename, unpacker);
+    return std::unique_ptr<Index>(new Index(is, filename, unpacker));
+}
+
+/** Detect the type of the file and extract it **/
+static void process(const char * filename, const Options &options, const char * argv0) {
+    File file(filename);
+    BinaryReader is(file, options.backend, options.blockSize);
+    ProgressScope scope(is);
+    
+    if (!options.cat.empty()||!options.mountPoint.empty()) {
+        // The log would get mixed with the printed file
+        auto index=openIndex(file, is, filename, options);
+        if (!options.mountPoint.empty()) {
+            if (mount(*index, options.mountPoint))
+                throw "cannot mount "+options.mountPoint;
+            return;
+        }
+        StreamSink output(cout);
+        index->open(options.cat, output);
+        cout.flush();
+        return;
+    }
+    
+    // Listing prints a table of the files unless NDJSON is requested; the
+    // rest of the log is discarded when it would get mixed with the events
+    std::optional<TextEventSink> table;
+    EventSink * events=options.events.get();
+    if (options.listing&&!events)
+        events=&table.emplace(console());
+    std::ostream discard(nullptr);
+    std::optional<ConsoleRedirect> quiet;
+    if (options.listing||options.eventsToStdout)
+        quiet.emplace(discard);
+    std::optional<Store> store;
+    if (!options.store.empty()&&!options.listing)
+        store.emplace(options.store);
+    Output * output=store?&*store:nullptr;
+    // The state is saved when leaving, also if unpacking fails
+    string name=filename;
+    name=name.substr(name.rfind('/')+1);
+    std::optional<Incremental> incremental;
+    if (options.incremental&&!options.listing)
+        incremental.emplace(options.output+"/."+name+".state");
+    Incremental * state=incremental?&*incremental:nullptr;
+    if (!options.type.empty()&&!TypeRegistration::get(options.type))
+        throw "Backend `"+options.type+"` does not exist. Try `"+argv0+" -l` to list all backends.";
+    // Android sparse images are unpacked next to the file, Symbian flash images to flash by default
+    string directory=options.output;
+    if (options.type.empty()&&endsWith(filename, ".android")) {
+        size_t slash=string(filename).rfind('/');
+        directory=slash==string::npos?".":string(filename, slash);
+    }
+    else if (options.type.empty()&&endsWith(filename, ".img")&&directory.empty())
+        directory="flash";
+    Context context(directory, events, options.listing, options.filter, output, state);
+    
+    // With a saved index, listing needs no parsing, and neither does
+    // unpacking selected files if they are stored as is. Otherwise, or when
+    // the filter selects ids, the index is of no use and is not built
+    bool unpacked=false;
+    if (options.indexCache&&(options.listing||options.filter)&&!context.selectsIds()&&
+            !endsWith(filename, ".android")) {
+        auto index=openIndex(file, is, filename, options);
+        if (options.listing) {
+            if (index->replay(*events, context))
+                return;
+        }
+        else if (options.filter)
+            unpacked=index->extract(context);
+    }
+    
+    if (!unpacked)
+        Unpacker::unpack(is, filename, options.type, context);
+    
+    if (incremental)
+        console() << "Skipped " << incremental->getSkipped() << " unchanged files" << '\n';
+    if (store) {
+        // The manifest of the input is kept next to its files
+        string manifest=options.output+'/'+name+".manifest";
+        store->writeManifest(manifest, options.output);
+        console() << "Stored " << store->getFiles() << " files, " << store->getNewObjects() <<
+            " new objects, " << store->getSharedBytes() << " bytes shared, manifest " << manifest << '\n';
+    }
+}
+
+/** Run process() and record the outcome instead of letting exceptions escape **/
+static void run(Job &job, const Options &options, const char * argv0) {
+    auto start=std::chrono::steady_clock::now();
+    std::optional<StatisticsScope> collect;
+    if (options.stats)
+        collect.emplace(*(job.statistics=std::make_shared<Statistics>()));
+    TraceSpan span("file", job.filename);
+    try {
+        process(job.filename, options, argv0);
+        job.succeeded=true;
+    }
+    catch (const EOFException &ee) {
+        job.error="premature end of file or block";
+    }
+    catch (const char * error) {
+        job.error=error;
+    }
+    catch (const std::string &error) {
+        job.error=error;
+    }
+    catch (const std::exception &e) {
+        job.error=e.what();
+    }
+    std::chrono::duration<double> elapsed=std::chrono::steady_clock::now()-start;
+    job.seconds=elapsed.count();
+}
+
+/** Process the files with `threads` workers, printing the log of every file
+    at once when it is done **/
+static void runParallel(vector<Job> &jobs, const Options &options, unsigned threads, const char * argv0) {
+    std::atomic<size_t> next(0);
+    std::mutex outputMutex;
+    
+    auto worker=[&](unsigned thread) {
+        setThreadName("worker "+std::to_string(thread));
+        for (size_t i; (i=next++)<jobs.size();) {
+            std::ostringstream log;
+            {
+                ConsoleRedirect redirect(log);
+                run(jobs[i], options, argv0);
+            }
+            
+            std::lock_guard<std::mutex> lock(outputMutex);
+            cout << log.str() << std::flush;
+            if (!jobs[i].succeeded)
+                cerr << argv0 << ": " << jobs[i].filename << ": error: " << jobs[i].error << endl;
+        }
+    };
+    
+    vector<std::thread> pool;
+    for (unsigned i=1; i<threads; i++)
+        pool.emplace_back(worker, i);
+    worker(0);
+    for (auto i=pool.begin(); i!=pool.end(); ++i)
+        i->join();
+}
+
+/** Print the outcome and wall time of every file **/
+static void printSummary(const vector<Job> &jobs, double seconds) {
+    unsigned failed=0;
+    cerr << "Summary:" << endl;
+    for (auto i=jobs.begin(); i!=jobs.end(); ++i) {
+        cerr << "  " << (i->succeeded?"\e[32mok\e[0m    ":"\e[31mfailed\e[0m") << " " <<
+            std::fixed << std::setprecision(3) << std::setw(9) << i->seconds << "s  " << i->filename;
+        if (!i->succeeded) {
+            cerr << " (" << i->error << ")";
+            failed++;
+        }
+        cerr << endl;
+    }
+    cerr << jobs.size() << " files, " << failed << " failed, " <<
+        std::fixed << std::setprecision(3) << seconds << "s" << endl;
+}
+
+/** Print the statistics of every file and of all of them **/
+static void printStatistics(const vector<Job> &jobs, bool json) {
+    Statistics total;
+    for (auto i=jobs.begin(); i!=jobs.end(); ++i) {
+        if (!i->statistics)
+            continue;
+        total.add(*i->statistics);
+        if (json) {
+            string line="{\"file\":";
+            appendJSONString(line, i->filename);
+            cerr << line << ",\"handlers\":" << i->statistics->toJSON() << '}' << endl;
+        }
+        else {
+            cerr << "Statistics of " << i->filename << ":" << endl;
+            i->statistics->print(cerr);
+        }
+    }
+    if (jobs.size()<2)
+        return;
+    if (json)
+        cerr << "{\"total\":true,\"handlers\":" << total.toJSON() << '}' << endl;
+    else {
+        cerr << "Statistics of all files:" << endl;
+        total.print(cerr);
+    }
+}
 
 int main(int argc, char** argv) {
     try {
         if (argc == 1)
             throw "no path specified";
         
-        string output=".";
-        string type;
+        std::ofstream jsonFile;
+        std::optional<Trace> trace;
+        Options options;
+        unsigned threads=0;
         vector<const char *> files;
         
         for (int i=1; i<argc; i++) {
@@ -43,63 +299,152 @@ int main(int argc, char** argv) {
                 cerr << endl;
             }
             else if (strncmp(arg, "-o", 2) == 0) {
-                output = argv[++i];
+                options.output = argv[++i];
             }
             else if (strncmp(arg, "-t", 2) == 0) {
-                type = argv[++i];
+                options.type = argv[++i];
             }
-            else
-                files.emplace_back(arg);
-        }
-        
-        for (auto i=files.begin(); i!=files.end(); ++i) {
-            const char * filename=*i;
-            File file(filename);
-            BinaryReader is(file);
-            
-            if (type.empty()) {
-                if (endsWith(filename, ".android")) {
-                    // Android sparse image
-                    extractAndroidImage(is, filename);
-                }
-                else if (endsWith(filename, ".img")) {
-                    // Symbian flash image
-                    extractSymbianImage(is, output.empty()?"flash":output);
+            else if (strncmp(arg, "-b", 2) == 0) {
+                // Size of read-ahead blocks for files which cannot be mapped
+                options.blockSize = strtoul(argv[++i], nullptr, 0);
+            }
+            else if (strncmp(arg, "-j", 2) == 0) {
+                // Number of files processed in parallel
+                threads = strtoul(argv[++i], nullptr, 0);
+                if (!threads)
+                    threads = std::max(1U, std::thread::hardware_concurrency());
+            }
+            else if (strcmp(arg, "--sparse") == 0) {
+                setSparseMode(SPARSE_ZEROES);
+            }
+            else if (strcmp(arg, "--sparse=erased") == 0) {
+                setSparseMode(SPARSE_ERASED);
+            }
+            else if ((strcmp(arg, "-n") == 0)||(strcmp(arg, "--list") == 0)) {
+                // Only list the entries: offset, size, compression, path
+                options.listing = true;
+            }
+            else if (strncmp(arg, "--json", 6) == 0) {
+                // Events as NDJSON to a file or the standard output
+                if (arg[6]=='=') {
+                    jsonFile.open(arg+7, std::ios::out|std::ios::trunc);
+                    if (!jsonFile)
+                        throw "cannot open the NDJSON output file";
+                    options.events=std::make_shared<JsonEventSink>(jsonFile);
                 }
                 else {
-                    auto extract=TypeRegistration::resolve(is, filename);
-                    if (extract)
-                        extract(is, output);
-                    else
-                        cerr << filename << ": cannot determine file type" << endl;
+                    options.events=std::make_shared<JsonEventSink>(cout);
+                    options.eventsToStdout=true;
                 }
             }
-            else {
-                // Backend name was explicitly specified via the command line
-                auto extract=TypeRegistration::get(type);
-                if (extract)
-                    extract(is, output);
-                else {
-                    cerr << "Backend `" << type << "` does not exist. Try `" <<
-                        argv[0] << " -l` to list all backends." << endl;
-                }
+            else if (strcmp(arg, "--cat") == 0) {
+                // Print a single file to the standard output
+                options.cat = argv[++i];
+            }
+            else if (strcmp(arg, "--mount") == 0) {
+                // Serve the files of a container at a mount point
+                files.emplace_back(argv[++i]);
+                options.mountPoint = argv[++i];
+            }
+            else if (strcmp(arg, "--trace") == 0) {
+                // Spans of the work of all threads in the Chrome trace-event format
+                trace.emplace(argv[++i]);
+            }
+            else if (strncmp(arg, "--progress", 10) == 0) {
+                // Consumed and written bytes, rate and ETA, on the standard error or a descriptor
+                options.progress = arg[10]=='='?atoi(arg+11):STDERR_FILENO;
+            }
+            else if (strncmp(arg, "--stats", 7) == 0) {
+                // Counters and times of every handler, printed at exit
+                options.stats = true;
+                options.statsJSON = strcmp(arg+7, "=json") == 0;
+            }
+            else if (strcmp(arg, "--incremental") == 0) {
+                options.incremental = true;
+            }
+            else if (strncmp(arg, "--store=", 8) == 0) {
+                // Keep every distinct file once and link the output to it
+                options.store = arg+8;
+            }
+            else if (strncmp(arg, "--index-cache", 13) == 0) {
+                // Save the indexes of the inputs and use them next time
+                options.indexCache = std::make_shared<IndexCache>(arg[13]=='='?
+                    string(arg+14):IndexCache::getDefaultDirectory());
+            }
+            else if (strncmp(arg, "--include=", 10) == 0) {
+                filter(options).include(arg+10);
+            }
+            else if (strncmp(arg, "--exclude=", 10) == 0) {
+                filter(options).exclude(arg+10);
             }
+            else if (strncmp(arg, "--id=", 5) == 0) {
+                // Resource ids, section types or block types, depending on the format
+                filter(options).includeIds(arg+5);
+            }
+            else if (strncmp(arg, "--recursive", 11) == 0) {
+                // Unpack nested containers in memory, up to the given depth
+                setRecursionDepth(arg[11]=='='?strtoul(arg+12, nullptr, 0):8);
+            }
+            else if (strcmp(arg, "--io-uring") == 0) {
+                setAsyncIO(true);
+            }
+            else if (strncmp(arg, "-M", 2) == 0) {
+                options.backend = BinaryReader::CACHED;
+            }
+            else
+                files.emplace_back(arg);
         }
+        if (options.incremental&&!options.store.empty())
+            throw "--incremental cannot be used with --store";
+        if ((getSparseMode()!=SPARSE_NONE)&&!options.store.empty())
+            throw "--sparse cannot be used with --store, its objects are kept whole";
         
-        return 0;
-    }
-    catch (const EOFException &ee) {
-        cerr << argv[0] << ": error: premature end of file or block" << endl;
-        return 1;
+        vector<Job> jobs(files.size());
+        for (size_t i=0; i<files.size(); i++)
+            jobs[i].filename=files[i];
+        
+        // The total size of the inputs is the base of the ETA
+        std::optional<Progress> progress;
+        if (options.progress>=0) {
+            uint64_t total=0;
+            struct stat st;
+            for (auto i=files.begin(); i!=files.end(); ++i)
+                if (stat(*i, &st)==0)
+                    total+=st.st_size;
+            progress.emplace(options.progress, total);
+        }
+        
+        bool failed=false;
+        if (threads) {
+            auto start=std::chrono::steady_clock::now();
+            runParallel(jobs, options, threads, argv[0]);
+            std::chrono::duration<double> elapsed=std::chrono::steady_clock::now()-start;
+            progress.reset();
+            printSummary(jobs, elapsed.count());
+        }
+        else {
+            // One file after another, printing directly; a failed file does not stop the others
+            setThreadName("main");
+            for (auto i=jobs.begin(); i!=jobs.end(); ++i) {
+                run(*i, options, argv[0]);
+                if (!i->succeeded)
+                    cerr << argv[0] << ": " << i->filename << ": error: " << i->error << endl;
+            }
+            progress.reset();
+        }
+        
+        for (auto i=jobs.begin(); i!=jobs.end(); ++i)
+            failed|=!i->succeeded;
+        if (options.stats)
+            printStatistics(jobs, options.statsJSON);
+        if (trace)
+            trace->save();
+        return failed?1:0;
     }
     catch (const char * error) {
         cerr << argv[0] << ": error: " << error << endl;
         return 1;
     }
-    catch (const std::string &error) {
-        cerr << argv[0] << ": error: " << error << endl;
-        return 1;
-    }
     catch (const std::exception &e) {
         cerr << argv[0] << ": error: " << e.what() << endl;
         return 1;
@@ -6,12 +6,12 @@
 
 #include <iostream>
 #include <unix++/File.hpp>
-#include <unix++/FileSystem.hpp>
+#include "Codec.hpp"
 #include "REUtils.hpp"
 #include "StringUtils.hpp"
+#include "Trace.hpp"
 #include "TypeRegistration.hpp"
 
-using std::cout;
 using std::string;
 using std::wstring;
 
@@ -24,11 +24,15 @@ static wstring readName(BinaryReader &names, uint32_t offset) {
     return is.readWideString(length);
 }
 
+static const TypeRegistration::Signature SIGNATURES[]={
+    {"qres"},
+};
+
 static bool detect(BinaryReader &is, const string &filename) {
     return endsWith(filename, ".rcc");
 }
 
-static void extract(const string &outDir, const string &prefix,
+static void extract(const Context &context, const string &prefix,
         BinaryReader &tree, BinaryReader &data, BinaryReader &names,
         unsigned index=0) {
     BinaryReader node(tree, 14*index, BinaryReader::END);
@@ -38,51 +42,65 @@ static void extract(const string &outDir, const string &prefix,
     wstring name=readName(names, nameOff);
     string path=prefix;
     if (index) {
-        path+='/';
+        if (!path.empty())
+            path+='/';
         path+=convert(name);
     }
-    string outPath=outDir+'/'+path;
+    string outPath=context.getPath(path);
     
     if (flags&2) {
         // directory
-        cout << "Directory: " << convert(name) << "\n";
+        console() << "Directory: " << convert(name) << "\n";
         uint32_t nChildren=node.readInt();
         uint32_t childOffset=node.readInt();
         
-        try {
-            upp::FileSystem::mkdir(outPath.c_str(), 0700);
-        }
-        catch (...) {}
+        if (index&&!context.wantsDirectory(path))
+            return;
+        else if (index)
+            context.addDirectory(path, 14*index, 14);
+        TraceSpan span("dir", path, tree.debug()+14*index, 14*nChildren);
+        
+        Context(context, path).createDirectory();
         
         for (uint32_t i=0; i<nChildren; i++)
-            extract(outDir, path, tree, data, names, childOffset+i);
+            extract(context, path, tree, data, names, childOffset+i);
     }
     else {
         // regular file
-        cout << "File: " << convert(name) << "\n";
+        console() << "File: " << convert(name) << "\n";
         uint16_t country=node.readShort();
         uint16_t language=node.readShort();
         uint32_t offset=node.readInt();
         
         BinaryReader item(data, offset, BinaryReader::END);
         uint32_t length=item.readInt();
-        ByteArray resource;
         
+        console() << "Path: " << outPath << "\n";
+        if (!context.wants(path))
+            return;
+        // The uncompressed length which follows is a part of the contents
+        BinaryReader stored(item, item.tell(), length);
+        context.addEntry(path, stored, (flags&1)?"zlib":nullptr);
+        if (context.isListing())
+            return;
+        
+        auto sink=context.create(path, stored);
+        if (!sink)
+            return;
         if (flags&1) {
+            // Decompress straight into the file
             uint32_t uncompressedLength=item.readInt();
-            resource=item.read(length-sizeof(uint32_t));
-            resource=uncompress(resource, uncompressedLength);
+            Span resource=item.span(item.tell(), length-sizeof(uint32_t));
+            decode("zlib", resource.data(), resource.size(), *sink);
+        }
+        else {
+            Span resource=item.span(item.tell(), length);
+            sink->write(resource.data(), resource.size());
         }
-        else
-            resource=item.read(length);
-        
-        cout << "Path: " << outPath << "\n";
-        upp::File file(outPath.c_str(), O_WRONLY|O_CREAT|O_TRUNC);
-        file.write(resource.data(), resource.size());
     }
 }
 
-static void extract(BinaryReader &is, const string &outDir) {
+static void extract(BinaryReader &is, const Context &context) {
     BinaryReader header(is);
     if (header.readInt()!=MAGIC)
         throw "bad magic";
@@ -97,8 +115,8 @@ static void extract(BinaryReader &is, const string &outDir) {
     uint32_t nOff=header.readInt();
     BinaryReader names(is, nOff, BinaryReader::END);
     
-    extract(outDir, string(), tree, data, names);
-    cout << "DONE\n";
+    extract(context, string(), tree, data, names);
+    console() << "DONE\n";
 }
 
-TR(qt);
+TR_MAGIC(qt);
@@ -1,12 +1,13 @@
 #include <iostream>
 #include <unistd.h>
 #include <unix++/FileSystem.hpp>
+#include "AsyncIO.hpp"
+#include "Record.hpp"
 #include "REUtils.hpp"
 #include "StringUtils.hpp"
+#include "Trace.hpp"
 #include "TypeRegistration.hpp"
 
-using std::cout;
-using std::endl;
 using std::string;
 
 static const uint32_t BB5_COMMON_HEADER_MAGIC=0x809795A3U;
@@ -14,17 +15,44 @@ static const uint32_t ROFS_MAGIC=0x53464F52U;
 
 class FSDumpContext {
 public:
-    FSDumpContext(const std::string &path, uint32_t base) : path(path), base(base) {}
+    FSDumpContext(const Context &context, uint32_t base, WriteQueue &queue) :
+        context(context), base(base), queue(queue) {}
     FSDumpContext(const FSDumpContext &other, const std::string &name) :
-        path(other.path+'/'+name), base(other.base) {}
-    const std::string &getPath() const { return path; }
+        context(other.context, name), base(other.base), queue(other.queue) {}
+    const Context &getContext() const { return context; }
+    const std::string &getPath() const { return context.getOutputDir(); }
     uint32_t getBase() const { return base; }
+    WriteQueue &getQueue() const { return queue; }
     
 private:
-    std::string path;
+    Context context;
     uint32_t base;
+    WriteQueue &queue;
 };
 
+/** ROFS header after the magic number, the size and a reserved byte **/
+struct Header {
+    uint16_t formatVersion;
+    uint32_t dirTreeOffset;         // offset to start of directory structure
+    uint32_t dirTreeSize;           // size in bytes of directory
+    uint32_t dirFileEntriesOffset;  // offset to start of file entries
+    uint32_t dirFileEntriesSize;    // size in bytes of file entry block
+    int64_t time;
+    uint8_t versionMajor;
+    uint8_t versionMinor;
+    uint16_t versionBuild;
+    uint32_t imageSize;             // rofs image size
+    uint32_t checksum;
+    uint32_t maxImageSize;
+};
+
+using HeaderLayout=Layout<Header, BE<&Header::formatVersion>,
+    LE<&Header::dirTreeOffset>, LE<&Header::dirTreeSize>,
+    LE<&Header::dirFileEntriesOffset>, LE<&Header::dirFileEntriesSize>,
+    LE<&Header::time>, LE<&Header::versionMajor>, LE<&Header::versionMinor>,
+    BE<&Header::versionBuild>, BE<&Header::imageSize>, BE<&Header::checksum>,
+    BE<&Header::maxImageSize>>;
+
 class Entry {
 public:
     Entry(BinaryReader &is) {
@@ -37,9 +65,9 @@ public:
         name=eis.readShortUnicodeString();
     }
     void print(const char * type, Indent indent) {
-        cout << indent << type << ": " << name << endl;
-        cout << indent << ". Size: " << size << endl;
-        cout << indent << ". Address: " << Hex<>(address) << endl;
+        console() << indent << type << ": " << name << '\n';
+        console() << indent << ". Size: " << size << '\n';
+        console() << indent << ". Address: " << Hex<>(address) << '\n';
     }
     uint32_t getSize() const { return size; }
     uint32_t getAddress() const { return address; }
@@ -55,32 +83,36 @@ private:
 static void extractDir(BinaryReader &is, const FSDumpContext &dc, uint32_t offset, uint32_t size, Indent indent) {
     uint32_t base=dc.getBase();
     
-    cout << indent << "Path=" << dc.getPath() << endl;
-    mkdir(dc.getPath().c_str(), 0700);
+    console() << indent << "Path=" << dc.getPath() << '\n';
+    dc.getContext().createDirectory();
     
     if (offset<base)
         throw "offset<base";
     offset-=base;
     BinaryReader br0(is, offset, size+2); // HACK: 2 bytes added
+    TraceSpan span("dir", dc.getPath(), br0.debug(), size);
     size_t size2=br0.readShortLE();
     //size_t addHeaderSize=br0.readShortLE();
-    //cout << indent << "AddHeaderSize: " << addHeaderSize << endl;
+    //console() << indent << "AddHeaderSize: " << addHeaderSize << '\n';
     if (size!=size2)
-        cout << indent << "Warning: " << size << "<>" << size2 << endl;
+        console() << indent << "Warning: " << size << "<>" << size2 << '\n';
     BinaryReader br=br0.window(size2);
     br.readByte(); // padding;
     uint8_t firstEntryOffset=br.readByte();
     uint32_t fileBlockAddress=br.readIntLE();
     uint32_t fileBlockSize=br.readIntLE();
     
-    if (firstEntryOffset!=12) cout << indent << "WARNING!" << endl;
-    cout << indent << "First entry offset: " << unsigned(firstEntryOffset) << endl;
-    cout << indent << "File block address: " << Hex<>(fileBlockAddress) << endl;
-    cout << indent << "File block size: " << fileBlockSize << endl;
+    if (firstEntryOffset!=12) console() << indent << "WARNING!" << '\n';
+    console() << indent << "First entry offset: " << unsigned(firstEntryOffset) << '\n';
+    console() << indent << "File block address: " << Hex<>(fileBlockAddress) << '\n';
+    console() << indent << "File block size: " << fileBlockSize << '\n';
     
     while (!br.atEnd(2)) {
         Entry entry(br);
         entry.print("SubDir", indent);
+        if (!dc.getContext().wantsDirectory(entry.getName()))
+            continue;   // nothing in this subtree can be selected
+        dc.getContext().addDirectory(entry.getName(), entry.getAddress()-base, entry.getSize());
         FSDumpContext dc0(dc, entry.getName());
         extractDir(is, dc0, entry.getAddress(), entry.getSize(), indent);
     }
@@ -95,24 +127,28 @@ static void extractDir(BinaryReader &is, const FSDumpContext &dc, uint32_t offse
             Entry entry(fbis);
             entry.print("File", indent);
             uint32_t realAddress=entry.getAddress();
-            if (realAddress<base)
-                cout << indent << "    [SKIP]" << endl;
+            if (!dc.getContext().wants(entry.getName()))
+                continue;
+            else if (realAddress<base)
+                console() << indent << "    [SKIP]" << '\n';
             else {
                 realAddress-=base;
                 BinaryReader fileReader(is, realAddress, entry.getSize());
-                fileReader.extract(dc.getPath()+'/'+entry.getName(), true);
+                dc.getContext().addEntry(entry.getName(), fileReader);
+                if (!dc.getContext().isListing())
+                    dc.getContext().write(fileReader, entry.getName(), &dc.getQueue());
             }
         }
     }
 }
 
-void extractROFS(BinaryReader &is, const string &outDir, Indent indent) {
+void extractROFS(BinaryReader &is, const Context &context, Indent indent) {
     uint32_t magic=is.readIntLE();
-    cout << "magic " << Hex<>(magic) << endl;
+    console() << "magic " << Hex<>(magic) << '\n';
     if (magic==BB5_COMMON_HEADER_MAGIC) {
-        cout << indent << "This is a BB5 image" << endl;
+        console() << indent << "This is a BB5 image" << '\n';
         BinaryReader rofs(is, 1024, BinaryReader::END);
-        extractROFS(rofs, outDir, indent);
+        extractROFS(rofs, context, indent);
     }
     else if (magic!=ROFS_MAGIC)
         throw "wrong ROFS magic number";
@@ -120,31 +156,26 @@ void extractROFS(BinaryReader &is, const string &outDir, Indent indent) {
     uint8_t headerSize=is.readByte();
     uint8_t reversed=is.readByte();
     BinaryReader wis=is.window(headerSize-6);
-    uint16_t formatVersion=wis.readShort();
-    uint32_t dirTreeOffset=wis.readIntLE();    // offset to start of directory structure
-    uint32_t dirTreeSize=wis.readIntLE();        // size in bytes of directory
-    uint32_t dirFileEntriesOffset=wis.readIntLE();    // offset to start of file entries
-    uint32_t dirFileEntriesSize=wis.readIntLE();    // size in bytes of file entry block
-    int64_t time=wis.readLongLE();
-    uint8_t versionMajor=wis.readByte();
-    uint8_t versionMinor=wis.readByte();
-    uint16_t versionBuild=wis.readShort();
-    uint32_t image_size=wis.readInt(); // rofs image size
-    uint32_t checksum=wis.readInt();
-    uint32_t max_image_size=wis.readInt();
+    Header header=wis.readRecord<HeaderLayout>();
+    uint32_t dirTreeOffset=header.dirTreeOffset;
+    uint32_t dirTreeSize=header.dirTreeSize;
     
-    cout << "Header size: " << unsigned(headerSize) << endl;
-    cout << "Format version: " << formatVersion << endl;
-    cout << "Image version: " << unsigned(versionMajor) << '.' << unsigned(versionMinor) << '.' << versionBuild << endl;
-    cout << "Tree: " << Hex<>(dirTreeOffset) << '/' << dirTreeSize << endl;
-    cout << "File entries: " << Hex<>(dirFileEntriesOffset) << '/' << dirFileEntriesOffset << endl;
-    //cout << "VOffset: " << Hex<>(dirTreeOffset-0x30) << endl;
+    console() << "Header size: " << unsigned(headerSize) << '\n';
+    console() << "Format version: " << header.formatVersion << '\n';
+    console() << "Image version: " << unsigned(header.versionMajor) << '.' << unsigned(header.versionMinor) << '.' << header.versionBuild << '\n';
+    console() << "Tree: " << Hex<>(dirTreeOffset) << '/' << dirTreeSize << '\n';
+    console() << "File entries: " << Hex<>(header.dirFileEntriesOffset) << '/' << header.dirFileEntriesOffset << '\n';
+    //console() << "VOffset: " << Hex<>(dirTreeOffset-0x30) << '\n';
     
-    FSDumpContext dc(outDir, dirTreeOffset-0x30);
+    // File contents are written asynchronously while the tree is walked
+    WriteQueue queue;
+    FSDumpContext dc(context, dirTreeOffset-0x30, queue);
     extractDir(is, dc, dirTreeOffset, dirTreeSize, indent);
+    queue.wait();
 }
 
-void extractVolumes(BinaryReader &is, const string &outDir, Indent indent) {
+void extractVolumes(BinaryReader &is, const Context &context, Indent indent) {
+    TraceSpan span("volumes", is.debug(), is.available());
     unsigned i=0;
     for (bool end=false; !end; i++) {
         uint32_t offset=is.readIntLE();
@@ -157,36 +188,36 @@ void extractVolumes(BinaryReader &is, const string &outDir, Indent indent) {
         if ((offset==0xFFFFFFFF)&&(size==0xFFFFFFFF))
             end=true;
         else {
-            cout << indent << "Volume " << i << "\n";
+            console() << indent << "Volume " << i << "\n";
             Indent shift(indent);
-            cout << shift << "Data: " << offset << ':' << size << endl;
+            console() << shift << "Data: " << offset << ':' << size << '\n';
             if (unknown1)
-                cout << shift << "Unknown1: " << unknown1 << endl;
+                console() << shift << "Unknown1: " << unknown1 << '\n';
             if (unknown2)
-                cout << shift << "Unknown2: " << unknown2 << endl;
+                console() << shift << "Unknown2: " << unknown2 << '\n';
             if (unknown3)
-                cout << shift << "Unknown3: " << unknown3 << endl;
-            cout << shift << "Name: " << name << endl;
+                console() << shift << "Unknown3: " << unknown3 << '\n';
+            console() << shift << "Name: " << name << '\n';
             
             // Extract the partition
             if (offset!=0xFFFFFFFF) {
                 if (is.getSize()<offset+size) {
-                    cout << shift << "Truncating the partition" << endl;
+                    console() << shift << "Truncating the partition" << '\n';
                     size=is.getSize()-offset;
                 }
                 BinaryReader pis(is, offset, size);
-                pis.extract(outDir+"/"+name+".img");
+                context.save(pis, name+".img");
                 
                 if (name=="SOS-TOC") {
                     BinaryReader nis(is, offset, BinaryReader::END);
-                    extractVolumes(nis, outDir, indent);
+                    extractVolumes(nis, context, indent);
                 }
             }
         }
     }
 }
 
-void extractSymbianImage(BinaryReader &is, const string &outDir, Indent indent) {
+void extractSymbianImage(BinaryReader &is, const Context &context, Indent indent) {
     // Locate partition table
     size_t partitionTableOffset=0;
     BinaryReader isl(is);
@@ -200,23 +231,23 @@ void extractSymbianImage(BinaryReader &is, const string &outDir, Indent indent)
             partitionTableOffset+=32;
     }
     
-    cout << "Partition table found at " << partitionTableOffset << endl;
+    console() << "Partition table found at " << partitionTableOffset << '\n';
     BinaryReader contents(is, partitionTableOffset, BinaryReader::END);
-    extractVolumes(contents, outDir, indent);
+    extractVolumes(contents, context, indent);
 }
 
+static const TypeRegistration::Signature SIGNATURES[]={
+    {"ROFS"},
+    {"\xA3\x95\x97\x80"},   // BB5_COMMON_HEADER_MAGIC
+};
+
 static bool detect(BinaryReader &is, const string &filename) {
-    if (endsWith(filename, ".rofs"))
-        return true;
-    else if (is.readIntLE()==BB5_COMMON_HEADER_MAGIC)
-        return true;
-    else
-        return false;
+    return endsWith(filename, ".rofs");
 }
 
-static void extract(BinaryReader &is, const string &outDir) {
-    return extractROFS(is, outDir, Indent());
+static void extract(BinaryReader &is, const Context &context) {
+    return extractROFS(is, context, Indent());
 }
 
-TR(rofs);
+TR_MAGIC(rofs);
 
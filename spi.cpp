@@ -4,30 +4,25 @@
 #include "TypeRegistration.hpp"
 
 using std::cerr;
-using std::cout;
-using std::endl;
 using std::string;
 
 static const uint32_t SPI_MAGIC=0x10205C2B;
 
+static const TypeRegistration::Signature SIGNATURES[]={
+    {"\x2B\x5C\x20\x10"},   // SPI_MAGIC
+};
+
 static bool detect(BinaryReader &is, const string &filename) {
-    if (endsWith(filename, ".spi"))
-        return true;
-    else if (is.readIntLE()==SPI_MAGIC)
-        return true;
-    else
-        return false;
+    return endsWith(filename, ".spi");
 }
 
-static void extract(BinaryReader &is, const string &outDir) {
-    (void)outDir;
-    
+static void extract(BinaryReader &is, const Context &context) {
     // SPI header
     uint32_t magic=is.readIntLE();
     if (magic!=SPI_MAGIC)
         throw "wrong SPI file magic";
     
-    cout << "Type: " << Hex<>(is.readIntLE()) << endl;
+    console() << "Type: " << Hex<>(is.readIntLE()) << '\n';
     is.skip(24);
     
     while (!is.atEnd()) {
@@ -37,12 +32,13 @@ static void extract(BinaryReader &is, const string &outDir) {
         string filename=is.readString(fileNameLength);
         BinaryReader entry=is.window(fileSize);
         
-        cout << "Entry: " << filename << endl;
+        console() << "Entry: " << filename << '\n';
+        context.addEntry(filename, entry.debug(), fileSize);
         uint32_t uid0=entry.readIntLE();
-        cout << "    UID0: " << Hex<>(uid0) << endl;
+        console() << "    UID0: " << Hex<>(uid0) << '\n';
         uint32_t uid1=entry.readIntLE();
-        cout << "    UID0: " << Hex<>(uid1) << endl;
+        console() << "    UID0: " << Hex<>(uid1) << '\n';
     }
 }
 
-TR(spi);
+TR_MAGIC(spi);